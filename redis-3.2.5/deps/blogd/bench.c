@@ -0,0 +1,608 @@
+/* Blogd micro benchmarks.
+ *
+ * Build & run:
+ *   make bench && ./bench [routes|lookup|startup [threads]|sections|markdown|request]
+ *
+ * "request" times a copy of the request path. That the real one doesn't
+ * allocate once warm is checked by "make test-blogd" in src/.
+ */
+
+#include "router.h"
+#include "regx.h"
+#include "helper.h"
+#include "content.h"
+#include "template.h"
+#include "../../src/zmalloc.h"
+#include "../../src/sds.h"
+#include "../../src/dict.h"
+#include "../hiredis/hiredis.h"
+#include "../h3/include/h3.h"
+#include "../h3/src/mempool.h"
+#include "../http-parser/http_parser.h"
+#include "../sundown/src/markdown.h"
+#include "../sundown/src/buffer.h"
+#include "../sundown/html/html.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define BENCH_ROUNDS 200000
+
+static long long ustime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return ((long long) tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+static void report(const char *name, long long start, long long iterations) {
+    long long elapsed = ustime() - start;
+
+    if (elapsed == 0) elapsed = 1;
+
+    printf("%-32s %10lld ops/sec (%lld ops in %.3f sec)\n", name,
+           iterations * 1000000 / elapsed, iterations, (double) elapsed / 1000000);
+}
+
+/* ============================ Routes  ======================== */
+static char *benchUrls[] = {
+    "/",
+    "/page/2",
+    "/2016-11-08-failure-is-not-an-option",
+    "/themes/startbootstrap-clean-blog/css/clean-blog.min.css",
+    "/themes/startbootstrap-clean-blog/vendor/jquery/jquery.min.js",
+    "/themes/startbootstrap-clean-blog/img/home-bg.jpg",
+    "/not-found"
+};
+
+#define BENCH_NUM_URLS (sizeof(benchUrls) / sizeof(char*))
+
+// The route table as it was matched before, compiling every pattern per request
+static char *legacyPatterns[] = {
+    "^/$",
+    "(.*?)\\.(gif|jpg|jpeg|png|htm|html|js|css|woff|woff2|ttf)",
+    "/page/(\\d)+",
+    "/(.*)"
+};
+
+static int (*routeMatchers[])(char *path, char **matches) = {
+    matchIndexRoute, matchFileRoute, matchPageRoute, matchContentRoute
+};
+
+#define BENCH_NUM_ROUTES (sizeof(legacyPatterns) / sizeof(char*))
+
+static void benchLegacyRoutes(void) {
+    long long start = ustime(), n;
+    unsigned int i;
+
+    for (n = 0; n < BENCH_ROUNDS / 10; n++) {
+        char *url = benchUrls[n % BENCH_NUM_URLS];
+
+        for (i = 0; i < BENCH_NUM_ROUTES; i++) {
+            char **matches = preg_match(legacyPatterns[i], url);
+
+            if (matches) {
+                zfree(matches);
+                break;
+            }
+        }
+
+        // The reload query check
+        zfree(preg_match("secret-reload", ""));
+    }
+
+    report("routes (pcre per request)", start, n);
+}
+
+static void benchPrecompiledRoutes(void) {
+    pcre *res[BENCH_NUM_ROUTES];
+    char *matches[ROUTE_MAX_MATCHES];
+    long long start, n;
+    unsigned int i;
+    int numMatches;
+
+    for (i = 0; i < BENCH_NUM_ROUTES; i++) res[i] = preg_compile(legacyPatterns[i]);
+
+    start = ustime();
+
+    for (n = 0; n < BENCH_ROUNDS; n++) {
+        char *url = benchUrls[n % BENCH_NUM_URLS];
+
+        for (i = 0; i < BENCH_NUM_ROUTES; i++) {
+            if ((numMatches = preg_exec(res[i], url, matches, ROUTE_MAX_MATCHES)) >= 0) {
+                while (numMatches--) zfree(matches[numMatches]);
+                break;
+            }
+        }
+    }
+
+    report("routes (precompiled pcre)", start, n);
+
+    for (i = 0; i < BENCH_NUM_ROUTES; i++) pcre_free(res[i]);
+}
+
+static void benchMatcherRoutes(void) {
+    char *matches[ROUTE_MAX_MATCHES];
+    char path[256];
+    long long start = ustime(), n;
+    unsigned int i;
+
+    for (n = 0; n < BENCH_ROUNDS * 10; n++) {
+        // Matchers split the path in place, like the request handler's copy
+        strcpy(path, benchUrls[n % BENCH_NUM_URLS]);
+
+        for (i = 0; i < BENCH_NUM_ROUTES; i++) {
+            if (routeMatchers[i](path, matches) >= 0) break;
+        }
+
+        hasQueryParam("", "secret-reload");
+    }
+
+    report("routes (hand-written matchers)", start, n);
+}
+
+/* ============================ Keyspace lookup  ======================== */
+#define BENCH_NUM_KEYS 1000
+
+// dict.c reports its failed asserts through the server
+void _serverAssert(char *estr, char *file, int line) {
+    fprintf(stderr, "=== ASSERTION FAILED === %s:%d '%s'\n", file, line, estr);
+    abort();
+}
+
+static unsigned int benchSdsHash(const void *key) {
+    return dictGenHashFunction((unsigned char*) key, sdslen((sds) key));
+}
+
+static int benchSdsKeyCompare(void *privdata, const void *key1, const void *key2) {
+    (void) privdata;
+
+    return sdslen((sds) key1) == sdslen((sds) key2) &&
+           !memcmp(key1, key2, sdslen((sds) key1));
+}
+
+static void benchSdsDestructor(void *privdata, void *val) {
+    (void) privdata;
+
+    sdsfree(val);
+}
+
+static dictType benchKeyspaceDictType = {
+    benchSdsHash, NULL, NULL, benchSdsKeyCompare, benchSdsDestructor, NULL
+};
+
+static dict *createBenchKeyspace(void) {
+    dict *d = dictCreate(&benchKeyspaceDictType, NULL);
+    char slug[64];
+    int i;
+
+    for (i = 0; i < BENCH_NUM_KEYS; i++) {
+        snprintf(slug, sizeof(slug), "blogd::post::2016-11-%04d-some-post-title", i);
+        dictAdd(d, sdsnew(slug), NULL);
+    }
+
+    return d;
+}
+
+/* Split a "*<argc>\r\n$<len>\r\n<arg>\r\n..." query into sds arguments, as
+ * processMultibulkBuffer() does. Returns the number of arguments. */
+static int parseBenchMultibulk(const char *query, sds *argv, int maxArgs) {
+    const char *p = query + 1;
+    int argc = strtol(p, NULL, 10), j;
+
+    if (argc > maxArgs) argc = maxArgs;
+    p = strchr(p, '\r') + 2;
+
+    for (j = 0; j < argc; j++) {
+        long len = strtol(p + 1, NULL, 10);
+
+        p = strchr(p, '\r') + 2;
+        argv[j] = sdsnewlen(p, len);
+        p += len + 2;
+    }
+
+    return argc;
+}
+
+// The old page lookup: GET encoded with hiredis into querybuf, then parsed back
+static void benchRespLookup(void) {
+    dict *keyspace = createBenchKeyspace();
+    sds querybuf = sdsempty(), argv[2];
+    char slug[64];
+    long long start = ustime(), n;
+
+    for (n = 0; n < BENCH_ROUNDS; n++) {
+        snprintf(slug, sizeof(slug), "2016-11-%04d-some-post-title", (int) (n % BENCH_NUM_KEYS));
+
+        char *key = stringConcat("blogd::post::", slug);
+        const char *cmdArgv[] = {"getNoReplyCommand", key};
+        size_t cmdArgvLen[] = {17, strlen(key)};
+        char *cmd;
+        int cmdLen = redisFormatCommandArgv(&cmd, 2, cmdArgv, cmdArgvLen);
+
+        querybuf = sdscatlen(querybuf, cmd, cmdLen);
+
+        int argc = parseBenchMultibulk(querybuf, argv, 2);
+
+        if (!dictFind(keyspace, argv[1])) printf("missing key %s\n", argv[1]);
+
+        while (argc--) sdsfree(argv[argc]);
+        sdsclear(querybuf);
+        free(cmd);
+        zfree(key);
+    }
+
+    report("lookup (RESP round-trip)", start, n);
+
+    sdsfree(querybuf);
+    dictRelease(keyspace);
+}
+
+static void benchDirectLookup(void) {
+    dict *keyspace = createBenchKeyspace();
+    sds key = sdsempty();
+    char slug[64];
+    long long start = ustime(), n;
+
+    for (n = 0; n < BENCH_ROUNDS; n++) {
+        snprintf(slug, sizeof(slug), "2016-11-%04d-some-post-title", (int) (n % BENCH_NUM_KEYS));
+
+        key = sdscat(sdscpy(key, "blogd::post::"), slug);
+
+        if (!dictFind(keyspace, key)) printf("missing key %s\n", key);
+    }
+
+    report("lookup (direct dict)", start, n);
+
+    sdsfree(key);
+    dictRelease(keyspace);
+}
+
+/* ============================ Startup compile  ======================== */
+#define BENCH_NUM_POSTS 10000
+
+static char *benchLayout =
+    "<html><head><title>{{ title }}</title>"
+    "<meta name=\"description\" content=\"{{ meta_description }}\"></head>"
+    "<body>{{ content }}</body></html>";
+
+static char *benchPost =
+    "@section_title\nPost %d\n@endsection\n\n"
+    "@section_meta_description\nPost %d\n@endsection\n\n"
+    "@section_description\nMany say exploration is part of our destiny.\n@endsection\n\n"
+    "@section_published_at\nNovember 08, 2016\n@endsection\n\n"
+    "@section_thumbnail\n<img src=\"/img/post-sample-image.jpg\" alt=\"\">\n@endsection\n\n"
+    "@section_content\n<article>\n%s</article>\n@endsection\n";
+
+static char *benchParagraph =
+    "<p>Never in all their history have men been able truly to conceive of the world "
+    "as one: a single sphere, a globe, having the qualities of a globe, a round earth "
+    "in which all the directions eventually meet.</p>\n";
+
+typedef struct benchCorpus {
+    char dir[64];
+    char **paths;
+    template *layout;
+} benchCorpus;
+
+// Write BENCH_NUM_POSTS posts of about 4KB in a temporary directory
+static void createBenchCorpus(benchCorpus *corpus) {
+    sds body = sdsempty();
+    int i;
+
+    strcpy(corpus->dir, "/tmp/blogd-bench-XXXXXX");
+    if (!mkdtemp(corpus->dir)) {
+        perror("mkdtemp");
+        exit(1);
+    }
+
+    for (i = 0; i < 20; i++) body = sdscat(body, benchParagraph);
+
+    corpus->paths = zmalloc(sizeof(char*) * BENCH_NUM_POSTS);
+
+    for (i = 0; i < BENCH_NUM_POSTS; i++) {
+        char path[128];
+        FILE *fp;
+
+        snprintf(path, sizeof(path), "%s/%05d-post.tpl", corpus->dir, i);
+
+        if ((fp = fopen(path, "w")) == NULL) {
+            perror(path);
+            exit(1);
+        }
+
+        fprintf(fp, benchPost, i, i, body);
+        fclose(fp);
+
+        corpus->paths[i] = zstrdup(path);
+    }
+
+    sdsfree(body);
+}
+
+static void freeBenchCorpus(benchCorpus *corpus) {
+    int i;
+
+    for (i = 0; i < BENCH_NUM_POSTS; i++) {
+        unlink(corpus->paths[i]);
+        zfree(corpus->paths[i]);
+    }
+
+    zfree(corpus->paths);
+    rmdir(corpus->dir);
+}
+
+// What compileContents() does for each post: read it and compile it
+static void compileBenchPost(void *ctx, unsigned long i) {
+    benchCorpus *corpus = ctx;
+    char *fileContent = readFileContent(corpus->paths[i]);
+    compiledObj *obj = compileTemplate(fileContent, corpus->layout, 0, 0, 1);
+
+    freeCompiledObj(obj);
+    sdsfree(fileContent);
+}
+
+static void benchStartupCompile(int threads) {
+    benchCorpus corpus;
+    char name[64];
+    long long start;
+
+    createBenchCorpus(&corpus);
+    corpus.layout = parseTemplate(benchLayout);
+
+    start = ustime();
+    runParallel(BENCH_NUM_POSTS, 1, compileBenchPost, &corpus);
+    report("startup compile (1 thread)", start, BENCH_NUM_POSTS);
+
+    snprintf(name, sizeof(name), "startup compile (%d threads)", threads);
+    start = ustime();
+    runParallel(BENCH_NUM_POSTS, threads, compileBenchPost, &corpus);
+    report(name, start, BENCH_NUM_POSTS);
+
+    freeTemplate(corpus.layout);
+    freeBenchCorpus(&corpus);
+}
+
+/* ============================ Post sections  ======================== */
+#define BENCH_SECTIONS_SIZE (1024 * 1024)
+
+// The six section patterns compileTemplate() used to run on every post
+static char *legacySectionPatterns[] = {
+    "@section_title\\s*((.|\\n)*?)\\s*@endsection",
+    "@section_meta_description\\s*((.|\\n)*?)\\s*@endsection",
+    "@section_description\\s*((.|\\n)*?)\\s*@endsection",
+    "@section_thumbnail\\s*((.|\\n)*?)\\s*@endsection",
+    "@section_content\\s*((.|\\n)*?)\\s*@endsection",
+    "@section_published_at\\s*((.|\\n)*?)\\s*@endsection"
+};
+
+#define BENCH_NUM_SECTIONS (sizeof(legacySectionPatterns) / sizeof(char*))
+
+static sds createBenchMarkdown(size_t size) {
+    sds content = sdsempty();
+
+    while (sdslen(content) < size) {
+        content = sdscat(content, "## The Final Frontier\n\n");
+        content = sdscat(content, "Space, the *final* frontier. These are the voyages of the Starship "
+                                  "Enterprise, to boldly go where [no man](http://example.com) has gone before.\n\n");
+        content = sdscat(content, "- Science cuts two ways\n- Spaceflights cannot be stopped\n\n");
+    }
+
+    return content;
+}
+
+// A post with a markdown content section of BENCH_SECTIONS_SIZE bytes
+static sds createBenchLargePost(void) {
+    sds post = sdscatprintf(sdsempty(), benchPost, 1, 1, "");
+    sds content = createBenchMarkdown(BENCH_SECTIONS_SIZE);
+    char *split;
+
+    // Put it in place of the empty <article>
+    split = strstr(post, "</article>");
+    sds large = sdscatlen(sdsempty(), post, split - post);
+    large = sdscatsds(large, content);
+    large = sdscat(large, split);
+
+    sdsfree(content);
+    sdsfree(post);
+
+    return large;
+}
+
+static void benchLegacySections(sds post) {
+    long long start = ustime(), n;
+    unsigned int i;
+
+    for (n = 0; n < 5; n++) {
+        for (i = 0; i < BENCH_NUM_SECTIONS; i++) {
+            char **matches = preg_match(legacySectionPatterns[i], post);
+
+            if (!matches) {
+                printf("section %u did not match\n", i);
+                continue;
+            }
+
+            zfree(matches[0]);
+            zfree(matches[1]);
+            zfree(matches);
+        }
+    }
+
+    report("sections (6 regex passes, 1MB)", start, n);
+}
+
+static void benchScanSections(sds post) {
+    long long start = ustime(), n;
+
+    for (n = 0; n < 500; n++) {
+        contentSections *cs = parseContentSections(post, sdslen(post));
+
+        if (cs->numSections != BENCH_NUM_SECTIONS) printf("found %d sections\n", cs->numSections);
+        freeContentSections(cs);
+    }
+
+    report("sections (one scan, 1MB)", start, n);
+}
+
+/* ============================ Markdown  ======================== */
+#define BENCH_MARKDOWN_SIZE (8 * 1024)
+#define BENCH_MARKDOWN_EXTENSIONS (MKDEXT_TABLES | MKDEXT_FENCED_CODE | MKDEXT_AUTOLINK)
+
+// A new parser and a 64 bytes output buffer for every post, as it used to be
+static void benchFreshMarkdown(sds content) {
+    long long start = ustime(), n;
+
+    for (n = 0; n < BENCH_ROUNDS / 20; n++) {
+        struct sd_callbacks callbacks;
+        struct html_renderopt options;
+        struct sd_markdown *markdown;
+        struct buf *ob = bufnew(OUTPUT_UNIT);
+
+        sdhtml_renderer(&callbacks, &options, 0);
+        markdown = sd_markdown_new(BENCH_MARKDOWN_EXTENSIONS, MARKDOWN_MAX_NESTING, &callbacks, &options);
+
+        sd_markdown_render(ob, (const uint8_t *) content, sdslen(content), markdown);
+        sd_markdown_free(markdown);
+        bufrelease(ob);
+    }
+
+    report("markdown (parser per post, 8KB)", start, n);
+}
+
+static void benchPooledMarkdown(sds content) {
+    long long start = ustime(), n;
+
+    for (n = 0; n < BENCH_ROUNDS / 20; n++) {
+        releaseMarkdownContent(compileMarkdownContent(content, sdslen(content), BENCH_MARKDOWN_EXTENSIONS));
+    }
+
+    report("markdown (thread parser, 8KB)", start, n);
+}
+
+/* ============================ Request  ======================== */
+#define BENCH_ARENA_SIZE (32 * 1024)
+
+static char benchRequest[] =
+    "GET /2016-11-08-failure-is-not-an-option?utm_source=feed HTTP/1.1\r\n"
+    "Host: blog.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:50.0) Gecko/20100101 Firefox/50.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Referer: http://blog.example.com/\r\n"
+    "Connection: keep-alive\r\n\r\n";
+
+// The header, the url and its parts malloc'ed and freed for every request, as it used to be
+static void benchMallocRequest(void) {
+    long long start = ustime(), n;
+
+    for (n = 0; n < BENCH_ROUNDS * 5; n++) {
+        struct http_parser_url u;
+        RequestHeader *header = h3_request_header_new();
+
+        h3_request_header_parse(header, benchRequest, sizeof(benchRequest) - 1);
+
+        char *fullUrl = strndup(header->RequestURI, header->RequestURILen);
+        h3_request_header_free(header);
+
+        http_parser_parse_url(fullUrl, strlen(fullUrl), 0, &u);
+        char *urlPath = strndup(fullUrl + u.field_data[UF_PATH].off, u.field_data[UF_PATH].len);
+        char *urlQuery = strndup(fullUrl + u.field_data[UF_QUERY].off, u.field_data[UF_QUERY].len);
+
+        free(urlPath);
+        free(urlQuery);
+        free(fullUrl);
+    }
+
+    report("request (malloc)", start, n);
+}
+
+static char *benchArenaDup(h3_mpool *arena, const char *s, size_t len) {
+    char *p = h3_mpool_malloc(arena, (len + 8) & ~(size_t) 7);
+
+    memcpy(p, s, len);
+    p[len] = '\0';
+    return p;
+}
+
+// Same work from a bump arena cleared after each request
+static void benchArenaRequest(void) {
+    long long start = ustime(), n;
+    long long spills = 0;
+    h3_mpool arena;
+    char *buf = zmalloc(BENCH_ARENA_SIZE);
+
+    h3_mpool_init(&arena, buf, BENCH_ARENA_SIZE);
+
+    for (n = 0; n < BENCH_ROUNDS * 5; n++) {
+        struct http_parser_url u;
+        RequestHeader *header = h3_mpool_malloc(&arena, (sizeof(*header) + 7) & ~(size_t) 7);
+
+        memset(header, 0, sizeof(*header));
+        h3_request_header_parse(header, benchRequest, sizeof(benchRequest) - 1);
+
+        char *fullUrl = benchArenaDup(&arena, header->RequestURI, header->RequestURILen);
+
+        http_parser_parse_url(fullUrl, strlen(fullUrl), 0, &u);
+        benchArenaDup(&arena, fullUrl + u.field_data[UF_PATH].off, u.field_data[UF_PATH].len);
+        benchArenaDup(&arena, fullUrl + u.field_data[UF_QUERY].off, u.field_data[UF_QUERY].len);
+
+        // Set when a block had to come from malloc
+        spills += arena.cflag;
+        h3_mpool_clear(&arena);
+    }
+
+    report("request (arena)", start, n);
+    if (spills) printf("%lld requests spilled out of the arena\n", spills);
+
+    zfree(buf);
+}
+
+int main(int argc, char **argv) {
+    const char *only = argc > 1 ? argv[1] : NULL;
+
+    if (!only || !strcmp(only, "routes")) {
+        benchLegacyRoutes();
+        benchPrecompiledRoutes();
+        benchMatcherRoutes();
+    }
+
+    if (!only || !strcmp(only, "lookup")) {
+        benchRespLookup();
+        benchDirectLookup();
+    }
+
+    if (!only || !strcmp(only, "startup")) {
+        // Same default as the compile-threads config
+        int threads = argc > 2 ? atoi(argv[2]) : 4;
+
+        benchStartupCompile(threads > 0 ? threads : 1);
+    }
+
+    if (!only || !strcmp(only, "sections")) {
+        sds post = createBenchLargePost();
+
+        benchLegacySections(post);
+        benchScanSections(post);
+
+        sdsfree(post);
+    }
+
+    if (!only || !strcmp(only, "markdown")) {
+        sds content = createBenchMarkdown(BENCH_MARKDOWN_SIZE);
+
+        benchFreshMarkdown(content);
+        benchPooledMarkdown(content);
+
+        sdsfree(content);
+    }
+
+    if (!only || !strcmp(only, "request")) {
+        benchMallocRequest();
+        benchArenaRequest();
+    }
+
+    return 0;
+}
@@ -1,6 +1,7 @@
+#define _GNU_SOURCE
 #include "content.h"
 #include "helper.h"
-#include "regx.h"
+#include "template.h"
 #include "tinydir.h"
 #include "../sundown/src/markdown.h"
 #include "../sundown/src/buffer.h"
@@ -8,61 +9,245 @@
 #include "../../src/zmalloc.h"
 #include "../../src/sds.h"
 
-struct buf *compileMarkdownContent(char *content) {
-    struct buf *ob;
-    struct sd_callbacks callbacks;
-    struct html_renderopt options;
-    struct sd_markdown *markdown;
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
 
-    ob = bufnew(OUTPUT_UNIT);
+#define SECTION_START "@section_"
+#define SECTION_END "@endsection"
 
-    sdhtml_renderer(&callbacks, &options, 0);
-    markdown = sd_markdown_new(0, 16, &callbacks, &options);
+/* Split a template file into its sections in one scan. A section runs from
+ * "@section_<name>" to the next "@endsection", its value is trimmed of the
+ * surrounding white space. When a name is used twice, the first one wins. */
+contentSections *parseContentSections(const char *content, size_t len) {
+    contentSections *cs = zcalloc(sizeof(contentSections));
+    const char *p = content, *end = content + len;
 
-    sd_markdown_render(ob, (const uint8_t *) content, strlen(content), markdown);
-    sd_markdown_free(markdown);
+    while ((p = memmem(p, end - p, SECTION_START, sizeof(SECTION_START) - 1)) != NULL) {
+        const char *name = p + sizeof(SECTION_START) - 1, *value, *valueEnd;
 
-    return ob;
+        for (p = name; p < end && (isalnum((unsigned char) *p) || *p == '_' || *p == '-'); p++);
+
+        if (p == name) continue;
+
+        if ((valueEnd = memmem(p, end - p, SECTION_END, sizeof(SECTION_END) - 1)) == NULL) break;
+
+        sds key = sdsnewlen(name, p - name);
+
+        for (value = p; value < valueEnd && isspace((unsigned char) *value); value++);
+        p = valueEnd + sizeof(SECTION_END) - 1;
+        while (valueEnd > value && isspace((unsigned char) valueEnd[-1])) valueEnd--;
+
+        if (getContentSection(cs, key)) {
+            sdsfree(key);
+            continue;
+        }
+
+        cs->vars = zrealloc(cs->vars, sizeof(templateVar) * (cs->numSections + 1));
+        cs->vars[cs->numSections].name = key;
+        cs->vars[cs->numSections].value = value;
+        cs->vars[cs->numSections].len = valueEnd - value;
+        cs->numSections++;
+    }
+
+    return cs;
 }
 
-compiledObj *compileTemplate(char *fileContent, char *layoutContent, int markdownCompile, unsigned int useMarkdown) {
-    // Regx match
-    char **titleMatches = preg_match("@section_title\\s*((.|\\n)*?)\\s*@endsection", fileContent);
-    char **metaDescMatches = preg_match("@section_meta_description\\s*((.|\\n)*?)\\s*@endsection", fileContent);
-    char **descMatches = preg_match("@section_description\\s*((.|\\n)*?)\\s*@endsection", fileContent);
-    char **thumbnailMatches = preg_match("@section_thumbnail\\s*((.|\\n)*?)\\s*@endsection", fileContent);
-    char **contentMatches = preg_match("@section_content\\s*((.|\\n)*?)\\s*@endsection", fileContent);
-    char **publishedAtMatches = preg_match("@section_published_at\\s*((.|\\n)*?)\\s*@endsection", fileContent);
+templateVar *getContentSection(contentSections *cs, const char *name) {
+    int i;
 
-    compiledObj *obj = zmalloc(sizeof(compiledObj));
-    struct buf *ob;
-    char *content = "";
-
-    // Assign data
-    obj->title = titleMatches ? titleMatches[0] : "";
-    obj->meta_desc = metaDescMatches ? metaDescMatches[0] : "";
-    obj->desc = descMatches ? descMatches[0] : "";
-    obj->thumbnail = thumbnailMatches ? thumbnailMatches[0] : "";
-    obj->published_at = publishedAtMatches ? publishedAtMatches[0] : "";
-
-    if (contentMatches) {
-        if ((markdownCompile > 0) && (useMarkdown > 0)) {
-            ob = compileMarkdownContent(contentMatches[0]);
-            content = (char *) ob->data;
-        } else {
-            content = contentMatches[0];
+    for (i = 0; i < cs->numSections; i++) {
+        if (!strcmp(cs->vars[i].name, name)) return cs->vars + i;
+    }
+
+    return NULL;
+}
+
+void freeContentSections(contentSections *cs) {
+    int i;
+
+    for (i = 0; i < cs->numSections; i++) sdsfree((sds) cs->vars[i].name);
+
+    zfree(cs->vars);
+    zfree(cs);
+}
+
+/* ============================ Markdown  ======================== */
+static struct {
+    const char *name;
+    unsigned int flag;
+} markdownExtensions[] = {
+    {"tables", MKDEXT_TABLES},
+    {"fenced-code", MKDEXT_FENCED_CODE},
+    {"autolink", MKDEXT_AUTOLINK},
+    {"strikethrough", MKDEXT_STRIKETHROUGH},
+    {"superscript", MKDEXT_SUPERSCRIPT},
+    {"no-intra-emphasis", MKDEXT_NO_INTRA_EMPHASIS},
+    {"space-headers", MKDEXT_SPACE_HEADERS},
+    {"lax-spacing", MKDEXT_LAX_SPACING},
+    {0, 0}
+};
+
+/* Parse a space separated list of extension names ("tables autolink") into
+ * sundown MKDEXT_* flags. Returns -1 on an unknown name. */
+int markdownExtensionsFromString(const char *s) {
+    int flags = 0, count, i, j;
+    sds *names = sdssplitargs(s, &count);
+
+    if (!names) return -1;
+
+    for (i = 0; i < count && flags != -1; i++) {
+        for (j = 0; markdownExtensions[j].name != 0; j++) {
+            if (!strcasecmp(names[i], markdownExtensions[j].name)) break;
         }
+
+        if (markdownExtensions[j].name == 0) flags = -1;
+        else flags |= markdownExtensions[j].flag;
+    }
+
+    sdsfreesplitres(names, count);
+
+    return flags;
+}
+
+sds markdownExtensionsToString(int flags) {
+    sds s = sdsempty();
+    int j;
+
+    for (j = 0; markdownExtensions[j].name != 0; j++) {
+        if (!(flags & markdownExtensions[j].flag)) continue;
+
+        if (sdslen(s)) s = sdscatlen(s, " ", 1);
+        s = sdscat(s, markdownExtensions[j].name);
+    }
+
+    return s;
+}
+
+/* Creating a sundown parser allocates its callbacks and work buffers, so
+ * every thread keeps one for its whole life, with a few output buffers to
+ * reuse from one post to the next. */
+typedef struct markdownRenderer {
+    struct sd_markdown *markdown;
+    struct sd_callbacks callbacks;
+    struct html_renderopt options;   /* Must not move: sundown keeps a pointer to it */
+    unsigned int extensions;
+    struct buf *pool[MARKDOWN_POOL_SIZE];
+    int poolSize;
+} markdownRenderer;
+
+static pthread_key_t markdownRendererKey;
+static pthread_once_t markdownRendererOnce = PTHREAD_ONCE_INIT;
+
+static void freeMarkdownRenderer(void *arg) {
+    markdownRenderer *r = arg;
+
+    while (r->poolSize) bufrelease(r->pool[--r->poolSize]);
+    if (r->markdown) sd_markdown_free(r->markdown);
+    zfree(r);
+}
+
+static void createMarkdownRendererKey(void) {
+    pthread_key_create(&markdownRendererKey, freeMarkdownRenderer);
+}
+
+static markdownRenderer *getMarkdownRenderer(unsigned int extensions) {
+    markdownRenderer *r;
+
+    pthread_once(&markdownRendererOnce, createMarkdownRendererKey);
+
+    if ((r = pthread_getspecific(markdownRendererKey)) == NULL) {
+        r = zcalloc(sizeof(markdownRenderer));
+        sdhtml_renderer(&r->callbacks, &r->options, 0);
+        pthread_setspecific(markdownRendererKey, r);
     }
 
-    // Complied content
-    obj->compiled_content = "";
-    obj->compiled_content = strReplace("{{ title }}", obj->title, layoutContent);
-    obj->compiled_content = strReplace("{{ meta_description }}", obj->meta_desc, obj->compiled_content);
-    obj->compiled_content = strReplace("{{ content }}", content, obj->compiled_content);
+    if (!r->markdown || r->extensions != extensions) {
+        if (r->markdown) sd_markdown_free(r->markdown);
+
+        r->markdown = sd_markdown_new(extensions, MARKDOWN_MAX_NESTING, &r->callbacks, &r->options);
+        r->extensions = extensions;
+    }
+
+    return r;
+}
+
+/* Render 'content' with this thread's parser into a pooled buffer, already
+ * large enough for the usual output. Give it back with releaseMarkdownContent(). */
+struct buf *compileMarkdownContent(const char *content, size_t len, unsigned int extensions) {
+    markdownRenderer *r = getMarkdownRenderer(extensions);
+    struct buf *ob = r->poolSize ? r->pool[--r->poolSize] : bufnew(OUTPUT_UNIT);
+
+    ob->size = 0;
+    bufgrow(ob, len + (len >> 1) + OUTPUT_UNIT);
+
+    sd_markdown_render(ob, (const uint8_t *) content, len, r->markdown);
+
+    return ob;
+}
+
+void releaseMarkdownContent(struct buf *ob) {
+    markdownRenderer *r = pthread_getspecific(markdownRendererKey);
 
-    if (contentMatches && (markdownCompile > 0) && (useMarkdown > 0)) {
+    // Buffers of very large posts are not worth keeping
+    if (r && r->poolSize < MARKDOWN_POOL_SIZE && ob->asize <= MARKDOWN_POOL_MAX_BUFFER) {
+        r->pool[r->poolSize++] = ob;
+    } else {
         bufrelease(ob);
     }
+}
+
+/* Render 'tpl' with the values in 'extra', then the sections of 'cs'. The
+ * placeholders of sections the file does not have are left empty. */
+sds renderContentSections(template *tpl, contentSections *cs, templateVar *extra, int numExtra) {
+    int i, numVars = 0;
+    templateVar *vars = zmalloc(sizeof(templateVar) * (numExtra + cs->numSections + tpl->numSegments));
+
+    for (i = 0; i < numExtra; i++) vars[numVars++] = extra[i];
+    for (i = 0; i < cs->numSections; i++) vars[numVars++] = cs->vars[i];
+
+    // Looked up last, so only used when nothing above has the name
+    for (i = 0; i < tpl->numSegments; i++) {
+        if (tpl->segments[i].type != TEMPLATE_VAR) continue;
+
+        vars[numVars].name = tpl->segments[i].name;
+        vars[numVars].value = "";
+        vars[numVars].len = 0;
+        numVars++;
+    }
+
+    sds rendered = renderTemplate(tpl, vars, numVars);
+    zfree(vars);
+
+    return rendered;
+}
+
+/* Compile a template file into 'layout'. The sections point into
+ * 'fileContent', which must outlive the returned object. */
+compiledObj *compileTemplate(char *fileContent, template *layout, int markdownCompile,
+                             unsigned int markdownExtensions, unsigned int useMarkdown) {
+    compiledObj *obj = zmalloc(sizeof(compiledObj));
+    templateVar *content;
+
+    obj->sections = parseContentSections(fileContent, strlen(fileContent));
+    content = getContentSection(obj->sections, "content");
+
+    if (content && (markdownCompile > 0) && (useMarkdown > 0)) {
+        struct buf *ob = compileMarkdownContent(content->value, content->len, markdownExtensions);
+        templateVar markdown = {"content", (char *) ob->data, ob->size};
+
+        obj->compiled_content = renderContentSections(layout, obj->sections, &markdown, 1);
+        releaseMarkdownContent(ob);
+    } else {
+        obj->compiled_content = renderContentSections(layout, obj->sections, NULL, 0);
+    }
 
     return obj;
-}
\ No newline at end of file
+}
+
+void freeCompiledObj(compiledObj *obj) {
+    freeContentSections(obj->sections);
+    sdsfree(obj->compiled_content);
+    zfree(obj);
+}
@@ -1,18 +1,36 @@
 #ifndef BLOGD_CONTENT_H
 #define BLOGD_CONTENT_H
 
+#include "template.h"
+
 #define OUTPUT_UNIT 64
+#define MARKDOWN_MAX_NESTING 16
+#define MARKDOWN_POOL_SIZE 4                        /* Output buffers kept per thread */
+#define MARKDOWN_POOL_MAX_BUFFER (4 * 1024 * 1024)  /* Larger ones are freed after use */
+
+/* The "@section_<name> ... @endsection" blocks of a template file, as
+ * template values. Names are sds, values point into the parsed content. */
+typedef struct contentSections {
+    templateVar *vars;
+    int numSections;
+} contentSections;
 
 typedef struct compiledObj {
-    char *title;
-    char *meta_desc;
-    char *desc;
-    char *thumbnail;
-    char *published_at;
-    char *compiled_content;
+    contentSections *sections;
+    sds compiled_content;
 } compiledObj;
 
-struct buf *compileMarkdownContent(char *content);
-compiledObj *compileTemplate(char *fileContent, char *layoutContent, int markdownCompile, unsigned int useMarkdown);
+contentSections *parseContentSections(const char *content, size_t len);
+templateVar *getContentSection(contentSections *cs, const char *name);
+void freeContentSections(contentSections *cs);
+sds renderContentSections(template *tpl, contentSections *cs, templateVar *extra, int numExtra);
+
+int markdownExtensionsFromString(const char *s);
+sds markdownExtensionsToString(int flags);
+struct buf *compileMarkdownContent(const char *content, size_t len, unsigned int extensions);
+void releaseMarkdownContent(struct buf *ob);
+compiledObj *compileTemplate(char *fileContent, template *layout, int markdownCompile,
+                             unsigned int markdownExtensions, unsigned int useMarkdown);
+void freeCompiledObj(compiledObj *obj);
 
 #endif
@@ -10,6 +10,8 @@
 #include <unistd.h>
 #include <stdarg.h>
 #include <string.h>
+#include <pthread.h>
+#include <zlib.h>
 
 /* String helpers */
 char **convertToSds(int count, char** args) {
@@ -121,19 +123,26 @@ char *removeFileExt(char* mystr, char dot, char sep) {
     return retstr;
 }
 
+/* Read the text file 'path' into a new sds. NULL if it can't be opened or
+ * read, an empty file gives an empty sds. */
 char *readFileContent(char *path) {
-    char *content = sdsempty();
+    char *content;
     char buf[1024 + 1];
 
     FILE * fp = fopen(path, "r");
 
-    if (fp != NULL) {
-        while(fgets(buf, 1024 + 1,fp) != NULL)
-            content = sdscat(content, buf);
+    if (fp == NULL) return NULL;
 
-        fclose(fp);
+    content = sdsempty();
+    while(fgets(buf, 1024 + 1,fp) != NULL)
+        content = sdscat(content, buf);
+
+    if (ferror(fp)) {
+        sdsfree(content);
+        content = NULL;
     }
 
+    fclose(fp);
     return (char *) content;
 }
 
@@ -145,3 +154,94 @@ void createDir(char *path, mode_t mode) {
     }
 }
 
+/* Compression helpers */
+/* Compress 'len' bytes of 'data' into a new sds holding a gzip stream
+ * (RFC 1952), as sent with "Content-Encoding: gzip". NULL if zlib fails. */
+char *gzipCompress(const char *data, size_t len, int level) {
+    z_stream zs;
+    sds out;
+    int ret;
+
+    memset(&zs, 0, sizeof(zs));
+
+    // 15 window bits, +16 for a gzip header and trailer instead of zlib's
+    if (deflateInit2(&zs, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) return NULL;
+
+    out = sdsnewlen(NULL, deflateBound(&zs, len));
+
+    zs.next_in = (Bytef *) data;
+    zs.avail_in = len;
+    zs.next_out = (Bytef *) out;
+    zs.avail_out = sdslen(out);
+
+    ret = deflate(&zs, Z_FINISH);
+    deflateEnd(&zs);
+
+    if (ret != Z_STREAM_END) {
+        sdsfree(out);
+        return NULL;
+    }
+
+    sdssetlen(out, zs.total_out);
+    out[zs.total_out] = '\0';
+
+    return out;
+}
+
+/* Thread helpers */
+typedef struct parallelJob {
+    pthread_mutex_t lock;
+    unsigned long next;
+    unsigned long count;
+    void (*fn)(void *ctx, unsigned long i);
+    void *ctx;
+} parallelJob;
+
+static void *parallelWorker(void *arg) {
+    parallelJob *job = arg;
+    unsigned long i;
+
+    while (1) {
+        pthread_mutex_lock(&job->lock);
+        i = job->next++;
+        pthread_mutex_unlock(&job->lock);
+
+        if (i >= job->count) break;
+
+        job->fn(job->ctx, i);
+    }
+
+    return NULL;
+}
+
+/* Call fn(ctx, i) for every i in [0, count) on up to 'threads' threads,
+ * the calling one included, and return once all calls are done. Items are
+ * handed out one at a time so a few big ones do not stall a whole thread. */
+void runParallel(unsigned long count, int threads, void (*fn)(void *ctx, unsigned long i), void *ctx) {
+    parallelJob job;
+    pthread_t *tids;
+    int i, started = 0;
+
+    if (threads < 1) threads = 1;
+    if ((unsigned long) threads > count) threads = count;
+
+    job.next = 0;
+    job.count = count;
+    job.fn = fn;
+    job.ctx = ctx;
+    pthread_mutex_init(&job.lock, NULL);
+
+    tids = zmalloc(sizeof(pthread_t) * (threads + 1));
+
+    // If a thread can not be created the others just take its share
+    for (i = 1; i < threads; i++) {
+        if (pthread_create(&tids[started], NULL, parallelWorker, &job) == 0) started++;
+    }
+
+    parallelWorker(&job);
+
+    for (i = 0; i < started; i++) pthread_join(tids[i], NULL);
+
+    zfree(tids);
+    pthread_mutex_destroy(&job.lock);
+}
@@ -10,5 +10,7 @@ char* strConcat(int count, ...);
 char *removeFileExt(char* mystr, char dot, char sep);
 char *readFileContent(char *path);
 void createDir(char *path, mode_t mode);
+char *gzipCompress(const char *data, size_t len, int level);
+void runParallel(unsigned long count, int threads, void (*fn)(void *ctx, unsigned long i), void *ctx);
 
 #endif
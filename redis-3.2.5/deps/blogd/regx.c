@@ -66,11 +66,13 @@ char **preg_match(char *regxp, char *data) {
             ovector, /* Output vector for substring info */
             OVECCOUNT); /* Number of elements in the output */
 
+    pcre_free(re);
+
     if (rc < 0) {
         return NULL;
     }
 
-    char **results = (char**) zmalloc(OVECCOUNT * sizeof(char));
+    char **results = (char**) zmalloc(OVECCOUNT * sizeof(char*));
 
     if (rc < 0) {
         printf("Match did not catch all the groups \n");
@@ -90,6 +92,29 @@ char **preg_match(char *regxp, char *data) {
     return results;
 }
 
+int preg_exec(pcre *re, char *data, char **matches, int maxMatches) {
+    int rc, ovector[OVECCOUNT], groupsCount; //state integers
+    int it, len;
+
+    pcre_fullinfo(re, NULL, PCRE_INFO_CAPTURECOUNT, &groupsCount);
+
+    rc = pcre_exec(re, NULL, data, strlen(data), 0, 0, ovector, OVECCOUNT);
+
+    if (rc < 0) {
+        return -1;
+    }
+
+    if (groupsCount > maxMatches) groupsCount = maxMatches;
+
+    for (it = 0; it < groupsCount; it++) {
+        len = ovector[2*it+3] - ovector[2*it+2];
+        matches[it] = (char*) zmalloc(len + 1);
+        sprintf(matches[it], "%.*s", len, data + ovector[2*it+2]);
+    }
+
+    return groupsCount;
+}
+
 struct resulter **preg_match_all(char *regxp, char *data) {
     pcre *re = preg_compile(regxp); // Pcre pointer
     int rc, ovector[OVECCOUNT], offsetStart = 0, groupsCount; //state integers
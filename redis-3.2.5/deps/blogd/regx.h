@@ -27,6 +27,8 @@ pcre *preg_compile(char* regxp);
 
 char **preg_match(char *regxp, char *data);
 
+int preg_exec(pcre *re, char *data, char **matches, int maxMatches);
+
 struct resulter **preg_match_all(char *regxp, char *data);
 
 #ifdef	__cplusplus
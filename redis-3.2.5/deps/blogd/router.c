@@ -0,0 +1,81 @@
+#include "router.h"
+
+#include <string.h>
+
+static const char *fileExts[] = {
+    "gif", "jpg", "jpeg", "png", "htm", "html", "js", "css", "woff", "woff2", "ttf", 0
+};
+
+// "/"
+int matchIndexRoute(char *path, char **matches) {
+    (void) matches;
+
+    return (path[0] == '/' && path[1] == '\0') ? 0 : -1;
+}
+
+// "/<file>.<ext>" => [file, ext]
+int matchFileRoute(char *path, char **matches) {
+    char *dot = strrchr(path, '.');
+    unsigned int i;
+
+    if (!dot || strchr(dot, '/')) return -1;
+
+    // Never let a static path climb out of public dir
+    if (strstr(path, "/..")) return -1;
+
+    for (i = 0; fileExts[i] != 0; i++) {
+        if (!strcmp(dot + 1, fileExts[i])) {
+            *dot = '\0';
+            matches[0] = path;
+            matches[1] = dot + 1;
+            return 2;
+        }
+    }
+
+    return -1;
+}
+
+// "/page/<num>" => [num]
+int matchPageRoute(char *path, char **matches) {
+    char *num, *p;
+
+    if (strncmp(path, "/page/", 6)) return -1;
+
+    num = path + 6;
+
+    if (*num == '\0') return -1;
+
+    for (p = num; *p; p++) {
+        if (*p < '0' || *p > '9') return -1;
+    }
+
+    matches[0] = num;
+    return 1;
+}
+
+// "/<slug>" => [slug]
+int matchContentRoute(char *path, char **matches) {
+    if (path[0] != '/') return -1;
+
+    matches[0] = path + 1;
+    return 1;
+}
+
+// Check whether 'name' is one of the params of a "a=1&b&c=2" query string
+int hasQueryParam(const char *query, const char *name) {
+    size_t len = strlen(name);
+    const char *p = query;
+
+    if (len == 0) return 0;
+
+    while (p && *p) {
+        if (!strncmp(p, name, len) && (p[len] == '\0' || p[len] == '=' || p[len] == '&')) {
+            return 1;
+        }
+
+        p = strchr(p, '&');
+        if (p) p++;
+    }
+
+    return 0;
+}
@@ -0,0 +1,16 @@
+#ifndef BLOGD_ROUTER_H
+#define BLOGD_ROUTER_H
+
+#define ROUTE_MAX_MATCHES 4
+
+/* Hand-written matchers for the fixed route shapes. Each one returns the
+ * number of captured groups written into 'matches', or -1 if the path does
+ * not match. Captures point into 'path', which may be split in place. */
+int matchIndexRoute(char *path, char **matches);
+int matchFileRoute(char *path, char **matches);
+int matchPageRoute(char *path, char **matches);
+int matchContentRoute(char *path, char **matches);
+
+int hasQueryParam(const char *query, const char *name);
+
+#endif
@@ -0,0 +1,102 @@
+#include "template.h"
+#include "../../src/zmalloc.h"
+
+#include <string.h>
+
+static void addTemplateSegment(template *tpl, int type, const char *ptr, size_t len, sds name) {
+    templateSegment *seg;
+
+    tpl->segments = zrealloc(tpl->segments, sizeof(templateSegment) * (tpl->numSegments + 1));
+    seg = tpl->segments + tpl->numSegments++;
+
+    seg->type = type;
+    seg->ptr = ptr;
+    seg->len = len;
+    seg->name = name;
+
+    if (type == TEMPLATE_LITERAL) tpl->literalLen += len;
+}
+
+/* Split 'source' into literals and "{{ name }}" placeholders. An unclosed
+ * "{{" is kept as literal text. */
+template *parseTemplate(const char *source) {
+    template *tpl = zcalloc(sizeof(template));
+    const char *p, *open, *close;
+
+    tpl->source = sdsnew(source);
+    p = tpl->source;
+
+    while ((open = strstr(p, "{{")) != NULL && (close = strstr(open + 2, "}}")) != NULL) {
+        sds name = sdsnewlen(open + 2, close - open - 2);
+
+        sdstrim(name, " \t\r\n");
+
+        if (open > p) addTemplateSegment(tpl, TEMPLATE_LITERAL, p, open - p, NULL);
+        addTemplateSegment(tpl, TEMPLATE_VAR, open, close + 2 - open, name);
+
+        p = close + 2;
+    }
+
+    if (*p) addTemplateSegment(tpl, TEMPLATE_LITERAL, p, strlen(p), NULL);
+
+    return tpl;
+}
+
+void freeTemplate(template *tpl) {
+    int i;
+
+    if (!tpl) return;
+
+    for (i = 0; i < tpl->numSegments; i++) sdsfree(tpl->segments[i].name);
+
+    zfree(tpl->segments);
+    sdsfree(tpl->source);
+    zfree(tpl);
+}
+
+static templateVar *lookupTemplateVar(templateSegment *seg, templateVar *vars, int numVars) {
+    int i;
+
+    for (i = 0; i < numVars; i++) {
+        if (!strcmp(seg->name, vars[i].name)) return vars + i;
+    }
+
+    return NULL;
+}
+
+/* Fill the placeholders with 'vars' into a new string, allocated once at
+ * its final size. Placeholders without a value are kept as they are, so a
+ * template can be rendered in several steps (e.g. the layout includes). */
+sds renderTemplate(template *tpl, templateVar *vars, int numVars) {
+    size_t len = tpl->literalLen;
+    templateVar *var;
+    char *p;
+    sds s;
+    int i;
+
+    for (i = 0; i < tpl->numSegments; i++) {
+        templateSegment *seg = tpl->segments + i;
+
+        if (seg->type != TEMPLATE_VAR) continue;
+
+        var = lookupTemplateVar(seg, vars, numVars);
+        len += var ? var->len : seg->len;
+    }
+
+    s = sdsnewlen(NULL, len);
+    p = s;
+
+    for (i = 0; i < tpl->numSegments; i++) {
+        templateSegment *seg = tpl->segments + i;
+
+        if (seg->type == TEMPLATE_VAR && (var = lookupTemplateVar(seg, vars, numVars)) != NULL) {
+            memcpy(p, var->value, var->len);
+            p += var->len;
+        } else {
+            memcpy(p, seg->ptr, seg->len);
+            p += seg->len;
+        }
+    }
+
+    return s;
+}
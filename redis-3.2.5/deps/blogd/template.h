@@ -0,0 +1,36 @@
+#ifndef BLOGD_TEMPLATE_H
+#define BLOGD_TEMPLATE_H
+
+#include <stddef.h>
+#include "../../src/sds.h"
+
+#define TEMPLATE_LITERAL 0
+#define TEMPLATE_VAR 1
+
+/* A template is parsed once into literal and "{{ name }}" segments, then
+ * rendered as many times as needed in a single pass over the segments. */
+typedef struct templateSegment {
+    int type;
+    const char *ptr;    /* Into the template source: the literal or the whole placeholder */
+    size_t len;
+    sds name;           /* Trimmed placeholder name, TEMPLATE_VAR only */
+} templateSegment;
+
+typedef struct template {
+    sds source;
+    templateSegment *segments;
+    int numSegments;
+    size_t literalLen;  /* Bytes of literal text, summed once at parse time */
+} template;
+
+typedef struct templateVar {
+    const char *name;
+    const char *value;
+    size_t len;
+} templateVar;
+
+template *parseTemplate(const char *source);
+void freeTemplate(template *tpl);
+sds renderTemplate(template *tpl, templateVar *vars, int numVars);
+
+#endif
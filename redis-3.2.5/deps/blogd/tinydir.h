@@ -521,16 +521,24 @@ int tinydir_readfile(const tinydir_dir *dir, tinydir_file *file)
         return -1;
     }
 
+#ifdef _MSC_VER
     _tinydir_strcpy(file->path, dir->path);
     _tinydir_strcat(file->path, TINYDIR_STRING("/"));
-    _tinydir_strcpy(file->name,
-#ifdef _MSC_VER
-            dir->_f.cFileName
+    _tinydir_strcpy(file->name, dir->_f.cFileName);
+    _tinydir_strcat(file->path, file->name);
 #else
-                    dir->_e->d_name
+    /* Both lengths were checked above: bounded copies, gcc can't tell the
+     * strcat() into path from name doesn't overlap (-Wrestrict) */
+    {
+        size_t path_len = _tinydir_strlen(dir->path);
+        size_t name_len = _tinydir_strlen(dir->_e->d_name);
+
+        memcpy(file->name, dir->_e->d_name, name_len + 1);
+        memcpy(file->path, dir->path, path_len);
+        file->path[path_len] = '/';
+        memcpy(file->path + path_len + 1, file->name, name_len + 1);
+    }
 #endif
-    );
-    _tinydir_strcat(file->path, file->name);
 #ifndef _MSC_VER
 #ifdef __MINGW32__
     if (_tstat(
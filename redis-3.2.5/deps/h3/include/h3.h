@@ -14,7 +14,7 @@
 
 // CRLF string for readibility
 #define CRLF "\r\n"
-#define MAX_HEADER_SIZE 20
+#define MAX_HEADER_SIZE 64
 
 enum H3_ERROR { 
     H3_ERR_REQUEST_LINE_PARSE_FAIL = -1,
@@ -96,18 +96,27 @@ int h3_request_header_parse(RequestHeader *header, const char *body, int bodyLen
     iscrlf(p); p+=2;
     if (end(p)) return 0;
 
+    // No header fields at all
+    if (iscrlf(p)) return 0;
+
 
 
     header->HeaderSize = 0;
 
     // Parse Header Fields Here
     do {
+        // Too many fields to keep: fail instead of writing past Fields
+        if (header->HeaderSize == MAX_HEADER_SIZE) return -1;
+
         HeaderField *field = & header->Fields[ header->HeaderSize++ ];
         // HeaderField *field = h3_header_field_new();
         field->FieldName = p; // start of a header field name
 
         while(notend(p) && *p != ':' ) p++;
         field->FieldNameLen = p - field->FieldName;
+
+        // A field without ':' must not step over the terminating null
+        if (end(p)) return -1;
         p++; // skip ':'
 
         // CRLF is not allowed here
@@ -183,6 +183,10 @@ void *bioProcessBackgroundJobs(void *arg) {
             close((long)job->arg1);
         } else if (type == BIO_AOF_FSYNC) {
             aof_fsync((long)job->arg1);
+        } else if (type == BIO_COMPILE_CONTENTS) {
+            compileContentsJob(job->arg1); /* Extend */
+        } else if (type == BIO_ACCESS_LOG) {
+            writeAccessLogJob(job->arg1); /* Extend */
         } else {
             serverPanic("Wrong job type in bioProcessBackgroundJobs().");
         }
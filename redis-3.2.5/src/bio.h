@@ -38,4 +38,6 @@ void bioKillThreads(void);
 /* Background job opcodes */
 #define BIO_CLOSE_FILE    0 /* Deferred close(2) syscall. */
 #define BIO_AOF_FSYNC     1 /* Deferred AOF fsync. */
-#define BIO_NUM_OPS       2
+#define BIO_COMPILE_CONTENTS 2 /* Extend: content reload, see reloadContents(). */
+#define BIO_ACCESS_LOG    3 /* Extend: access log write, see flushAccessLog(). */
+#define BIO_NUM_OPS       4
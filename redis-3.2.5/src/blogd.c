@@ -1,640 +1,4095 @@
 #include "server.h"
+#include "slowlog.h"
+#include "crc64.h"
+#include "bio.h"
 #include "../deps/h3/include/h3.h"
+#include "../deps/h3/src/mempool.h"
 #include "../deps/http-parser/http_parser.h"
 #include "../deps/blogd/helper.h"
 #include "../deps/blogd/tinydir.h"
 #include "../deps/blogd/regx.h"
+#include "../deps/blogd/router.h"
 
-#include <hiredis.h>
 #include <signal.h>
 #include <stdio.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#ifdef HAVE_SENDFILE
+#include <sys/sendfile.h>
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
 
 httpMime httpMimes[] = {
-    {"gif", "image/gif" },
-    {"jpg", "image/jpeg"},
-    {"jpeg","image/jpeg"},
-    {"png", "image/png" },
-    {"htm", "text/html; charset=UTF-8" },
-    {"html","text/html; charset=UTF-8" },
-    {"js","application/javascript"     },
-    {"css","text/css"   },
-    {"woff","application/font-woff"   },
-    {"woff2","application/font-woff2"   },
-    {"ttf","application/octet-stream"   },
-    {0, 0}
+    {"gif", "image/gif", 0},
+    {"jpg", "image/jpeg", 0},
+    {"jpeg","image/jpeg", 0},
+    {"png", "image/png", 0},
+    {"htm", "text/html; charset=UTF-8", 1},
+    {"html","text/html; charset=UTF-8", 1},
+    {"js","application/javascript", 1},
+    {"css","text/css", 1},
+    {"woff","application/font-woff", 0},
+    {"woff2","application/font-woff2", 0},
+    {"ttf","application/octet-stream", 1},
+    {0, 0, 0}
 };
 
 httpRoute httpRoutes[] = {
-    {"^/$", responseHttpIndex},
-    {"(.*?)\\.(gif|jpg|jpeg|png|htm|html|js|css|woff|woff2|ttf)", responseHttpFile},
-    {"/page/(\\d)+", responseHttpPage},
-    {"/(.*)", responseHttpContent}
+    {"index", "^/$", responseHttpIndex, matchIndexRoute, NULL},
+    {"file", "(.*?)\\.(gif|jpg|jpeg|png|htm|html|js|css|woff|woff2|ttf)$", responseHttpFile, matchFileRoute, NULL},
+    {"page", "^/page/(\\d+)$", responseHttpPage, matchPageRoute, NULL},
+    {"content", "^/(.*)", responseHttpContent, matchContentRoute, NULL}
 };
 
-/* ============================ Helpers  ======================== */
-int formatRedisCommand(char **cmd, int argc, char **argv) {
-    size_t *argvlen;
-    int j;
+#define HTTP_NUM_ROUTES (sizeof(httpRoutes) / sizeof(struct httpRoute))
+
+/* Metrics of the requests answered outside httpRoutes */
+#define HTTP_ROUTE_METRICS HTTP_NUM_ROUTES       /* metrics-path */
+#define HTTP_ROUTE_NONE (HTTP_NUM_ROUTES + 1)    /* Rejected before routing */
+
+/* An event loop serving HTTP connections: the main one, then one per http
+ * worker. Only its own thread touches it, but for the counters summed by
+ * INFO and the metrics. */
+typedef struct httpLoop {
+    aeEventLoop *el;
+    int worker;                       /* Runs on its own thread, serves 'snapshot' */
+    pthread_t thread;
+    int ipfd[CONFIG_BINDADDR_MAX];    /* Its SO_REUSEPORT listening sockets */
+    int ipfdCount;
+    httpConn *conns;                  /* Linked by prev and next */
+    httpConn *freeConns;              /* Kept for reuse, up to HTTP_CONN_POOL_SIZE */
+    int numFreeConns;
+    sds readbuf;                      /* Every read goes here first, see readHttpConn() */
+    httpSnapshotRef *snapshot;        /* The current one of a worker */
+    unsigned long snapshotVersion;
+    sds lookupKey;                    /* Reused, no allocation per lookup */
+    sds filePath;                     /* Same, for the public file of a request */
+    h3_mpool arena;                   /* Cleared after each request, see allocHttpRequest() */
+    robj *notModified;                /* Status line of the 304 responses */
+    robj *crlf;
+    dict *staticFiles;                /* Public file path -> staticFile */
+    dict *staticMemory;               /* Public file path -> whole 200 response */
+    size_t staticMemoryUsed;
+    unsigned long staticEpoch;        /* httpStaticEpoch its caches were emptied at */
+    dict *responseCache;              /* Request path -> httpCachedResponse */
+    sds cacheKey;                     /* Path of the request being answered */
+    int cacheFilling;                 /* Its route's lookups go to cacheFill */
+    httpCachedResponse cacheFill;
+    long long responseCacheHits;
+    long long responseCacheMisses;
+    httpStats *routeStats;            /* HTTP_NUM_ROUTES + 2 */
+    httpStats *statusStats;           /* HTTP_NUM_STATUS_CODES + 1 */
+    accessLogBuffer accessLog[2];
+    accessLogBuffer *accessLogActive; /* NULL when there is no access log */
+    size_t accessLogSize;             /* Of each buffer */
+    unsigned int accessLogSkipped;    /* Requests since the last sampled one */
+    long long accessLogLines;         /* Lines appended to a buffer */
+    long long accessLogDropped;       /* Lines that found the buffer full */
+    time_t accessLogTimeAt;           /* The second accessLogTime shows */
+    char accessLogTime[64];
+    size_t accessLogTimeLen;
+    long long netOutput;              /* Bytes written to its connections */
+    long long netOutputSeen;          /* Part of it in stat_net_output_bytes */
+    long long numConnections;         /* Connections it accepted */
+    long long numConnectionsSeen;     /* Part of it in stat_numconnections */
+    long long rejectedConns;          /* Connections it refused */
+    long long rejectedConnsSeen;      /* Part of it in stat_rejected_conn */
+    time_t idleCheckedAt;
+} httpLoop;
+
+static httpLoop *httpLoops;           /* The main loop, then the workers */
+static int httpNumLoops;
+static long long httpConnections;     /* Open on every loop, updated atomically */
+static unsigned long httpStaticEpoch; /* Bumped by emptyStaticFiles(), atomically */
+
+static void addHttpConnReply(httpConn *c, robj *o, staticFile *file, off_t offset, size_t length,
+                             int borrowed);
+static const char *getHttpConnPeerId(httpConn *c);
+static void responseHttpObject(httpConn *c, robj *o, int borrowed);
 
-    /* Setup argument length */
-    argvlen = zmalloc(argc * sizeof(size_t));
-    for (j = 0; j < argc; j++)
-        argvlen[j] = sdslen(argv[j]);
-
-    return redisFormatCommandArgv(cmd, argc, (const char**) argv, argvlen);
+/* ============================ Redis Commands  ======================== */
+static robj *lookupRedisKeyReadOrReply(client *c, robj *key) {
+    robj *o = lookupKeyRead(c->db, key);
+    if (!o) return NULL;
+    return o;
 }
 
-int buildRedisCommand(char **cmd, char *argvs[], int argc) {
-    char **argv = zmalloc(sizeof(char*) * argc);
+int getRedisNoReplyCommand(void *cl) {
+    robj *o;
+    client *c = (client*) cl;
 
-    int j;
+    if ((o = lookupRedisKeyReadOrReply(c,c->argv[1])) == NULL) {
+        c->command_last_reply = NULL;
+        c->command_last_error = "Not found";
+        return C_OK;
+    }
 
-    for (j = 0; j < argc; j++) {
-        argv[j] = sdsnew(argvs[j]);
+    if (o->type != OBJ_STRING) {
+        c->command_last_reply = NULL;
+        c->command_last_error = shared.wrongtypeerr->ptr;
+        return C_ERR;
+    } else {
+        c->command_last_error = NULL;
+        c->command_last_reply = o->ptr;
+        return C_OK;
     }
+}
 
-    return formatRedisCommand(cmd, argc, convertToSds(argc, argv));
+/* ============================ Request arena  ======================== */
+/* What a request needs only while it is answered comes from a bump arena
+ * of its loop, cleared once it is: no malloc per request. Larger requests
+ * spill to malloc, freeHttpRequest() tells them apart. */
+static void *allocHttpRequest(httpLoop *loop, size_t len) {
+    // h3_mpool doesn't align, every block is kept on 8 bytes
+    return h3_mpool_malloc(&loop->arena, (len + 7) & ~(size_t) 7);
 }
 
-static struct client *createFakeClient(void) {
-    struct client *c = zmalloc(sizeof(*c));
+static char *dupHttpRequestString(httpLoop *loop, const char *s, size_t len) {
+    char *p = allocHttpRequest(loop, len + 1);
 
-    selectDb(c, 0);
-    c->fd = -1;
-    c->name = NULL;
-    c->querybuf = sdsempty();
-    c->querybuf_peak = 0;
-    c->argc = 0;
-    c->argv = NULL;
-    c->bufpos = 0;
-    c->flags = 0;
-    c->btype = BLOCKED_NONE;
-    /* We set the fake client as a slave waiting for the synchronization
-     * so that Redis will not try to send replies to this client. */
-    c->replstate = SLAVE_STATE_WAIT_BGSAVE_START;
-    c->reply = listCreate();
-    c->reply_bytes = 0;
-    c->obuf_soft_limit_reached_time = 0;
-    c->watched_keys = listCreate();
-    c->peerid = NULL;
-    listSetFreeMethod(c->reply,decrRefCountVoid);
-    listSetDupMethod(c->reply,dupClientReplyValue);
-    initClientMultiState(c);
-    return c;
+    memcpy(p, s, len);
+    p[len] = '\0';
+    return p;
 }
 
-static void freeFakeClientArgv(struct client *c) {
-    int j;
-
-    for (j = 0; j < c->argc; j++)
-        decrRefCount(c->argv[j]);
-    zfree(c->argv);
+static void freeHttpRequest(httpLoop *loop, void *p) {
+    h3_mpool_free(&loop->arena, p);
 }
 
-void executeRedisCommand(char **argvs, unsigned int argc) {
-    struct client *fakeClient = createFakeClient();
+/* ============================ Keyspace lookup  ======================== */
+static struct redisCommand *httpLookupCommand; /* getNoReplyCommand, for its stats */
 
-    struct redisCommand *cmd;
-    robj **argv;
-    argv = zmalloc(sizeof(robj*) * argc);
+/* Fetch the response stored at 'variant' + 'prefix' + 'suffix' straight
+ * from the db, without encoding a command into querybuf and parsing it
+ * back. It still counts as a getNoReplyCommand call: keyspace hits and
+ * misses, LRU, command stats and the slowlog are updated as call() would.
+ * A worker reads the snapshot of its loop instead, and touches none of
+ * them. Returns NULL when the key is missing or does not hold a string. */
+static robj *lookupHttpKey(httpConn *c, const char *variant, const char *prefix, const char *suffix) {
+    httpLoop *loop = c->loop;
+    long long start, duration;
+    robj key, *o;
 
-    fakeClient->argc = argc;
-    fakeClient->argv = argv;
+    loop->lookupKey = sdscat(sdscat(sdscpy(loop->lookupKey, variant), prefix), suffix);
 
-    unsigned int i;
+    if (loop->worker) return dictFetchValue(loop->snapshot->snapshot->responses, loop->lookupKey);
 
-    for (i = 0; i < argc; i++) {
-        sds argsds = sdsnewlen(NULL, strlen(argvs[i]));
-        sdscpy(argsds, argvs[i]);
-        argv[i] = createObject(OBJ_STRING, argsds);
-    }
+    start = ustime();
+    initStaticStringObject(key, loop->lookupKey);
 
-    /* Command lookup */
-    cmd = lookupCommand(argv[0]->ptr);
+    o = lookupKeyRead(server.db, &key);
+    if (o && (o->type != OBJ_STRING || !sdsEncodedObject(o))) o = NULL;
 
-    /* Run the command in the context of a fake client */
-    cmd->proc(fakeClient);
+    duration = ustime() - start;
+    httpLookupCommand->calls++;
+    httpLookupCommand->microseconds += duration;
+    server.stat_numcommands++;
 
-    /* Clean up. Command code may have changed argv/argc so we use the
-     * argv/argc of the client instead of the local variables. */
-    freeFakeClientArgv(fakeClient);
+    // Only a logged entry needs real objects, the key above lives on the stack
+    if (server.slowlog_log_slower_than >= 0 && duration >= server.slowlog_log_slower_than) {
+        robj *argv[2];
 
-    zfree(fakeClient);
-    fakeClient = NULL;
-}
+        argv[0] = createStringObject(httpLookupCommand->name, strlen(httpLookupCommand->name));
+        argv[1] = createStringObject(loop->lookupKey, sdslen(loop->lookupKey));
+        slowlogPushEntryIfNeeded(argv, 2, duration);
+        decrRefCount(argv[0]);
+        decrRefCount(argv[1]);
+    }
 
-void callRedisCommand(void *cl, int readlen, size_t qblen, char **argvs, int argc) {
-    char *cmd;
-    int nread = buildRedisCommand(&cmd, argvs, argc);
+    return o;
+}
 
-    client *c = (client*) cl;
+/* The response at 'prefix' + 'suffix', gzipped if the client takes it and
+ * there is such a variant. On a miss the lookupKey of the loop is the plain
+ * key. While the response cache is filled both variants are looked up, the
+ * next requests of the path may take the other one. */
+robj *lookupHttpResponse(void *cl, const char *prefix, const char *suffix) {
+    httpConn *c = (httpConn*) cl;
+    httpLoop *loop = c->loop;
+    robj *o;
 
-    c->querybuf = sdsMakeRoomFor(c->querybuf, readlen);
+    if (loop->cacheFilling) {
+        loop->cacheFill.gzip = lookupHttpKey(c, GZIP_KEY_PREFIX, prefix, suffix);
+        loop->cacheFill.response = lookupHttpKey(c, "", prefix, suffix);
 
-    strcpy(c->querybuf + qblen, cmd);
+        return (c->accept & HTTP_ACCEPT_GZIP) && loop->cacheFill.gzip ?
+            loop->cacheFill.gzip : loop->cacheFill.response;
+    }
 
-    sdsIncrLen(c->querybuf, nread);
+    if ((c->accept & HTTP_ACCEPT_GZIP) &&
+        (o = lookupHttpKey(c, GZIP_KEY_PREFIX, prefix, suffix)) != NULL) return o;
 
-    c->lastinteraction = server.unixtime;
+    return lookupHttpKey(c, "", prefix, suffix);
+}
 
-    if (c->flags & CLIENT_MASTER) c->reploff += nread;
+/* Store a compiled page as one pre-serialized response (status line, headers
+ * and body), so serving it is a refcount on the value and a writev(2). */
+static robj *createHttpResponse(const char *ext, const char *content, size_t len,
+                                unsigned int code, int encoding, const httpCache *cache)
+{
+    sds response = buildHttpHeaders(ext, len, code, encoding, cache);
+    response = sdscatlen(response, content, len);
 
-    server.stat_net_input_bytes += nread;
+    return createObject(OBJ_STRING, response);
+}
 
-    if (sdslen(c->querybuf) > server.client_max_querybuf_len) {
-        sds ci = catClientInfoString(sdsempty(),c), bytes = sdsempty();
+/* The gzip variant of a response, or NULL when compressing does not make
+ * it smaller. Slow on purpose (HTTP_GZIP_LEVEL): it only runs at compile. */
+static robj *createHttpGzipResponse(const char *ext, const char *content, size_t len, unsigned int code,
+                                    const httpCache *cache)
+{
+    sds gzipped = gzipCompress(content, len, HTTP_GZIP_LEVEL);
+    robj *response = NULL;
 
-        bytes = sdscatrepr(bytes,c->querybuf,64);
-        serverLog(LL_WARNING,"Closing client that reached max query buffer length: %s (qbuf initial bytes: %s)", ci, bytes);
-        sdsfree(ci);
-        sdsfree(bytes);
-        freeClient(c);
-        return;
+    if (gzipped && sdslen(gzipped) < len) {
+        response = createHttpResponse(ext, gzipped, sdslen(gzipped), code, HTTP_ENCODING_GZIP, cache);
     }
 
-    processInputBuffer(c);
+    sdsfree(gzipped);
+    return response;
 }
 
-/* ============================ Redis Commands  ======================== */
-static robj *lookupRedisKeyReadOrReply(client *c, robj *key) {
-    robj *o = lookupKeyRead(c->db, key);
-    if (!o) return NULL;
-    return o;
+/* Caching headers of a compiled body: its crc64 is the ETag */
+static void initHttpCache(httpCache *cache, const char *control, const char *content, size_t len,
+                          time_t lastModified)
+{
+    cache->control = control;
+    cache->etag = crc64(0, (const unsigned char*) content, len) | 1;
+    cache->lastModified = lastModified;
+    cache->ranges = 0;
 }
 
-int getRedisNoReplyCommand(void *cl) {
-    robj *o;
-    client *c = (client*) cl;
+static const httpCache httpNoCache = {HTTP_CACHE_NONE, 0, 0, 0};
 
-    if ((o = lookupRedisKeyReadOrReply(c,c->argv[1])) == NULL) {
-        c->command_last_reply = NULL;
-        c->command_last_error = "Not found";
-        return C_OK;
-    }
+static void saveHttpResponse(char *key, char *content, unsigned int code) {
+    robj *keyobj = createStringObject(key, strlen(key));
+    robj *val = createHttpResponse("html", content, strlen(content), code, HTTP_ENCODING_NONE, &httpNoCache);
 
-    if (o->type != OBJ_STRING) {
-        c->command_last_reply = NULL;
-        c->command_last_error = shared.wrongtypeerr->ptr;
-        return C_ERR;
-    } else {
-        c->command_last_error = NULL;
-        c->command_last_reply = o->ptr;
-        return C_OK;
+    setKey(server.db, keyobj, val);
+    server.dirty++;
+
+    decrRefCount(keyobj);
+    decrRefCount(val);
+}
+
+/* ============================ Http snapshot  ======================== */
+/* The http workers can't read the keyspace the main thread writes to, they
+ * serve a snapshot of its blogd:: keys published after each content load.
+ * Workers never touch the refcount of its responses: a connection pins the
+ * snapshot while it sends them, the last release hands it back to the main
+ * thread which frees it in httpCron(). */
+static pthread_mutex_t httpSnapshotLock = PTHREAD_MUTEX_INITIALIZER;
+static httpSnapshot *httpSnapshotPublished; /* Under httpSnapshotLock */
+static httpSnapshot *httpSnapshotsReleased; /* To free, under httpSnapshotLock */
+static unsigned long httpSnapshotVersion;   /* Bumped under the lock, read atomically */
+
+static void releaseHttpSnapshot(httpSnapshot *snapshot) {
+    pthread_mutex_lock(&httpSnapshotLock);
+    if (--snapshot->refcount == 0) {
+        snapshot->next = httpSnapshotsReleased;
+        httpSnapshotsReleased = snapshot;
     }
+    pthread_mutex_unlock(&httpSnapshotLock);
 }
 
-/* ============================ Init contents  ======================== */
-void initContents(char *content_dir) {
-    char *contentPath = stringConcat(content_dir, "/posts/");
+/* Freeze the responses of the keyspace for the workers. Only references
+ * are taken: a snapshot costs a dict entry per response. */
+void publishHttpSnapshot(void) {
+    httpSnapshot *snapshot, *old;
+    dictIterator *di;
+    dictEntry *de;
 
-    char *layoutFilePath = stringConcat(content_dir, "/layout.tpl");
-    char *headerFilePath = stringConcat(content_dir, "/header.tpl");
-    char *contentTopFilePath = stringConcat(content_dir, "/content_top.tpl");
-    char *footerFilePath = stringConcat(content_dir, "/footer.tpl");
-    char *postFilePath = stringConcat(content_dir, "/post.tpl");
-    char *pageFilePath = stringConcat(content_dir, "/page.tpl");
+    if (!server.http_workers) return;
 
-    char *error400FilePath = stringConcat(content_dir, "/errors/400.tpl");
-    char *error404FilePath = stringConcat(content_dir, "/errors/404.tpl");
-    char *error500FilePath = stringConcat(content_dir, "/errors/500.tpl");
+    snapshot = zmalloc(sizeof(*snapshot));
+    snapshot->responses = dictCreate(&dbDictType, NULL);
+    snapshot->refcount = 1;
+    snapshot->next = NULL;
 
-    char *postsContents = "";
-    char *layoutContent = readFileContent(layoutFilePath);
-    char *headerContent = readFileContent(headerFilePath);
-    char *topContent = readFileContent(contentTopFilePath);
-    char *footerContent = readFileContent(footerFilePath);
-    char *postContent = readFileContent(postFilePath);
-    char *pageContent = readFileContent(pageFilePath);
+    di = dictGetIterator(server.db->dict);
+    while ((de = dictNext(di)) != NULL) {
+        sds key = dictGetKey(de);
+        robj *o = dictGetVal(de);
 
-    char *error400Content = readFileContent(error400FilePath);
-    char *error404Content = readFileContent(error404FilePath);
-    char *error500Content = readFileContent(error500FilePath);
-    
-    if (!layoutContent || !headerContent || !topContent || !footerContent || !postContent || !pageContent) {
-        serverLog(LL_WARNING, "PLEASE CHECK CONTENTS DIRECTORY PATH: There is not enough files to run");
-        exit(1);
-    }
+        if (strncmp(key, BLOGD_KEY_PREFIX, sizeof(BLOGD_KEY_PREFIX) - 1)) continue;
+        if (o->type != OBJ_STRING || !sdsEncodedObject(o)) continue;
 
-    if (!error400Content || !error404Content || !error500Content) {
-        serverLog(LL_WARNING, "PLEASE CHECK ERRORS DIRECTORY PATH: There is not enough files to run");
-        exit(1);
+        incrRefCount(o);
+        dictAdd(snapshot->responses, sdsdup(key), o);
     }
+    dictReleaseIterator(di);
 
-    layoutContent = strReplace("{{ include header }}", headerContent, layoutContent);
-    layoutContent = strReplace("{{ include content_top }}", topContent, layoutContent);
-    layoutContent = strReplace("{{ include footer }}", footerContent, layoutContent);
+    // A lookup on a rehashing dict moves entries, the workers only read it
+    while (dictIsRehashing(snapshot->responses)) dictRehash(snapshot->responses, 100);
 
-    // Init 400 error page
-    compiledObj *obj400 = compileTemplate(error400Content, layoutContent, server.markdown_compile, 1);
-    char *argvs400[] = {"set", stringConcat(PAGE_ERROR_KEY_PREFIX, "400"), obj400->compiled_content};
-    executeRedisCommand(argvs400, 3);
-    zfree(obj400); obj400 = NULL;
+    pthread_mutex_lock(&httpSnapshotLock);
+    old = httpSnapshotPublished;
+    httpSnapshotPublished = snapshot;
+    __sync_add_and_fetch(&httpSnapshotVersion, 1);
+    pthread_mutex_unlock(&httpSnapshotLock);
 
-    // Init 404 error page
-    compiledObj *obj404 = compileTemplate(error404Content, layoutContent, server.markdown_compile, 1);
-    char *argvs404[] = {"set", stringConcat(PAGE_ERROR_KEY_PREFIX, "404"), obj404->compiled_content};
-    executeRedisCommand(argvs404, 3);
-    zfree(obj404); obj404 = NULL;
+    if (old) releaseHttpSnapshot(old);
+}
 
-    // Init 500 error page
-    compiledObj *obj500 = compileTemplate(error500Content, layoutContent, server.markdown_compile, 1);
-    char *argvs500[] = {"set", stringConcat(PAGE_ERROR_KEY_PREFIX, "500"), obj500->compiled_content};
-    executeRedisCommand(argvs500, 3);
-    zfree(obj500); obj500 = NULL;
+/* Drop a pin of a loop on its snapshot, the last one releases it */
+static void unpinHttpSnapshot(httpSnapshotRef *ref) {
+    if (--ref->pins > 0) return;
 
-    unsigned int i, j = 0, numFiles = 0, pageIndex = 1;
+    releaseHttpSnapshot(ref->snapshot);
+    zfree(ref);
+}
 
-    tinydir_dir dir;
-    tinydir_open_sorted(&dir, contentPath);
+/* Move a worker to the snapshot published last. Connections still sending
+ * responses of the previous one keep it pinned. */
+static void refreshHttpSnapshot(httpLoop *loop) {
+    httpSnapshotRef *ref;
 
-    for (i = 0; i < dir.n_files; i++) {
-        tinydir_file file;
-        tinydir_readfile_n(&dir, &file, i);
+    if (__atomic_load_n(&httpSnapshotVersion, __ATOMIC_ACQUIRE) == loop->snapshotVersion) return;
 
-        if (!file.is_dir) {
-            numFiles++;
-        }
+    ref = zmalloc(sizeof(*ref));
+    ref->pins = 1;
+
+    pthread_mutex_lock(&httpSnapshotLock);
+    ref->snapshot = httpSnapshotPublished;
+    ref->snapshot->refcount++;
+    loop->snapshotVersion = httpSnapshotVersion;
+    pthread_mutex_unlock(&httpSnapshotLock);
+
+    // The cached responses were borrowed from the previous one
+    dictEmpty(loop->responseCache, NULL);
+
+    if (loop->snapshot) unpinHttpSnapshot(loop->snapshot);
+    loop->snapshot = ref;
+}
+
+/* Called on the main thread, the only one that may release responses */
+static void freeReleasedHttpSnapshots(void) {
+    httpSnapshot *snapshot, *next;
+
+    pthread_mutex_lock(&httpSnapshotLock);
+    snapshot = httpSnapshotsReleased;
+    httpSnapshotsReleased = NULL;
+    pthread_mutex_unlock(&httpSnapshotLock);
+
+    for (; snapshot; snapshot = next) {
+        next = snapshot->next;
+        dictRelease(snapshot->responses);
+        zfree(snapshot);
     }
+}
 
-    for (i = 0; i < dir.n_files; i++) {
-        tinydir_file file;
-        tinydir_readfile_n(&dir, &file, i);
+/* ============================ Static files  ======================== */
+static httpMime *getHttpMime(const char *ext) {
+    unsigned int i;
+
+    for (i = 0; httpMimes[i].ext != 0; i++) {
+        if (!strcmp(ext, httpMimes[i].ext)) return httpMimes + i;
+    }
 
-        if (!file.is_dir) {
-            char *fileContent = readFileContent(file.path);
+    return NULL;
+}
 
-            if (fileContent) {
-                serverLog(LL_NOTICE, "Compile file '%s'...", file.name);
+static int isHttpCompressible(const char *ext) {
+    httpMime *mime = getHttpMime(ext);
 
-                // Compiled file name
-                char *fileName = removeFileExt(file.name, '.', '/');
+    return mime && mime->compress;
+}
 
-                // Compile template
-                compiledObj *obj = compileTemplate(fileContent, layoutContent, server.markdown_compile, 1);
+/* Public files are validated by mtime and size, hashing them would mean
+ * reading every one of them before its first response. */
+static void initStaticFileCache(httpCache *cache, time_t mtime, off_t size) {
+    cache->control = server.cache_control_static;
+    cache->etag = crc64(crc64(0, (const unsigned char*) &mtime, sizeof(mtime)),
+                        (const unsigned char*) &size, sizeof(size)) | 1;
+    cache->lastModified = mtime;
+    cache->ranges = 1;
+}
 
-                // Save content
-                char *argvs[] = {"set", stringConcat(POST_KEY_PREFIX, fileName), obj->compiled_content};
-                executeRedisCommand(argvs, 3);
+/* The part of a static cache budget each loop gets, the workers share it */
+static size_t getStaticCacheShare(size_t budget) {
+    return server.http_workers ? budget / server.http_workers : budget;
+}
 
-                // Compile post content
-                char *postCompiledContent = strReplace("{{ title }}", obj->title, postContent);
-                postCompiledContent = strReplace("{{ thumbnail }}", obj->thumbnail, postCompiledContent);
-                postCompiledContent = strReplace("{{ description }}", obj->desc, postCompiledContent);
-                postCompiledContent = strReplace("{{ published_at }}", obj->published_at, postCompiledContent);
-                postCompiledContent = strReplace("{{ link }}", stringConcat("/", fileName), postCompiledContent);
+/* Return the public file at 'path', opening it only on the first request.
+ * Up to 'static-fd-cache' files stay open in the staticFiles of the loop,
+ * the others are closed as soon as their last response is sent. NULL if
+ * not a file. */
+staticFile *lookupStaticFile(httpLoop *loop, sds path, char *ext) {
+    staticFile *file;
+    struct stat statbuf;
+    httpCache cache;
+    int fd;
 
-                postsContents = stringConcat(postsContents, postCompiledContent);
+    if ((file = dictFetchValue(loop->staticFiles, path)) != NULL) return file;
 
-                zfree(obj->compiled_content); obj->compiled_content = NULL;
-                zfree(obj); obj = NULL;
+    if ((fd = open(path, O_RDONLY)) == -1) return NULL;
 
-                if (((j % server.per_page) == (server.per_page - 1)) || (j == (numFiles - 1))) {
-                    // Re-assign index content
-                    char *pageCompiledContent = strReplace("{{ posts }}", postsContents, pageContent);
+    if (fstat(fd, &statbuf) == -1 || !S_ISREG(statbuf.st_mode)) {
+        close(fd);
+        return NULL;
+    }
 
-                    char pageNumString[10];
-                    sprintf(pageNumString, "%d", pageIndex + 1);
+    initStaticFileCache(&cache, statbuf.st_mtime, statbuf.st_size);
 
-                    if (j < (numFiles - 1)) {
-                        char *moreHtml = "<ul class='pager'><li class='next'><a href='/page/{pageNum}'>More</a></li></ul>";
+    file = zmalloc(sizeof(*file));
+    file->fd = fd;
+    file->size = statbuf.st_size;
+    file->headers = createObject(OBJ_STRING, buildHttpHeaders(ext, statbuf.st_size, 200,
+        isHttpCompressible(ext) ? HTTP_ENCODING_IDENTITY : HTTP_ENCODING_NONE, &cache));
+    file->refcount = 0;
 
-                        moreHtml = strReplace("{pageNum}", pageNumString, moreHtml);
+    if (dictSize(loop->staticFiles) < getStaticCacheShare(server.static_fd_cache)) {
+        file->refcount++;
+        dictAdd(loop->staticFiles, sdsdup(path), file);
+    }
 
-                        pageCompiledContent = strReplace("{{ more }}", moreHtml, pageCompiledContent);
-                    } else {
-                        pageCompiledContent = strReplace("{{ more }}", "", pageCompiledContent);
-                    }
+    return file;
+}
 
-                    sprintf(pageNumString, "%d", pageIndex);
+void releaseStaticFile(staticFile *file) {
+    if (--file->refcount > 0) return;
 
-                    // Compile template
-                    compiledObj *obj = compileTemplate(pageCompiledContent, layoutContent, server.markdown_compile, 0);
+    close(file->fd);
+    decrRefCount(file->headers);
+    zfree(file);
+}
 
-                    char *argvs[] = {"set", stringConcat(PAGE_KEY_PREFIX, pageNumString), obj->compiled_content};
-                    executeRedisCommand(argvs, 3);
+/* Evict the least recently served files from the staticMemory of the loop
+ * until 'needed' more bytes fit in its budget. The victims are picked the
+ * way the maxmemory LRU policies do: the idlest of a few sampled entries. */
+static void evictStaticMemory(httpLoop *loop, size_t budget, size_t needed) {
+    dictEntry *samples[server.maxmemory_samples];
 
-                    zfree(postsContents);
-                    postsContents = "";
-                    pageIndex++;
+    while (loop->staticMemoryUsed + needed > budget && dictSize(loop->staticMemory) > 0) {
+        unsigned long long idle, maxIdle = 0;
+        dictEntry *victim = NULL;
+        int count, j;
 
-                    zfree(obj->compiled_content); obj->compiled_content = NULL;
-                    zfree(obj); obj = NULL;
-                    zfree(pageCompiledContent); pageCompiledContent = NULL;
-                }
+        count = dictGetSomeKeys(loop->staticMemory, samples, server.maxmemory_samples);
 
-                sdsfree(fileContent); fileContent = NULL;
-                zfree(fileName); fileName = NULL;
-                zfree(postCompiledContent); postCompiledContent = NULL;
+        for (j = 0; j < count; j++) {
+            idle = estimateObjectIdleTime(dictGetVal(samples[j]));
 
-                j++;
-            } else {
-                printf("Fail to open file '%s'", file.path);
+            if (!victim || idle > maxIdle) {
+                victim = samples[j];
+                maxIdle = idle;
             }
         }
+
+        if (!victim) break;
+
+        loop->staticMemoryUsed -= sdslen(((robj*) dictGetVal(victim))->ptr);
+        dictDelete(loop->staticMemory, dictGetKey(victim));
     }
+}
 
-    tinydir_close(&dir);
+/* Keep the whole 200 response of 'file', headers and body, in memory so
+ * the next requests are one writev(2) of a shared object. NULL if it is
+ * too large for the budget or can't be read. */
+static robj *loadStaticMemoryFile(httpLoop *loop, sds path, staticFile *file) {
+    size_t headersLen = sdslen(file->headers->ptr);
+    size_t budget = getStaticCacheShare(server.static_memory_cache);
+    off_t done = 0;
+    ssize_t n;
+    robj *o;
 
-    zfree(contentPath); contentPath = NULL;
-    zfree(layoutFilePath); layoutFilePath = NULL;
-    zfree(headerFilePath); headerFilePath = NULL;
-    zfree(contentTopFilePath); contentTopFilePath = NULL;
-    zfree(footerFilePath); footerFilePath = NULL;
-    zfree(postFilePath); postFilePath = NULL;
-    zfree(pageFilePath); pageFilePath = NULL;
-    zfree(error400FilePath); error400FilePath = NULL;
-    zfree(error404FilePath); error404FilePath = NULL;
-    zfree(error500FilePath); error500FilePath = NULL;
-    zfree(layoutContent); layoutContent = NULL;
+    if (file->size > HTTP_STATIC_MEMORY_MAX_FILE || headersLen + file->size > budget) return NULL;
 
-    sdsfree(headerContent); headerContent = NULL;
-    sdsfree(topContent); topContent = NULL;
-    sdsfree(footerContent); footerContent = NULL;
-    sdsfree(postContent); postContent = NULL;
-    sdsfree(pageContent); pageContent = NULL;
-    sdsfree(error400Content); error400Content = NULL;
-    sdsfree(error404Content); error404Content = NULL;
-    sdsfree(error500Content); error500Content = NULL;
+    sds response = sdsMakeRoomFor(sdsdup(file->headers->ptr), file->size);
+
+    while (done < file->size &&
+           (n = pread(file->fd, response + headersLen + done, file->size - done, done)) > 0) done += n;
+
+    if (done != file->size) {
+        sdsfree(response);
+        return NULL;
+    }
+
+    sdsIncrLen(response, file->size);
+    evictStaticMemory(loop, budget, sdslen(response));
+
+    o = createObject(OBJ_STRING, response);
+    dictAdd(loop->staticMemory, sdsdup(path), o);
+    loop->staticMemoryUsed += sdslen(response);
+    return o;
 }
 
-/* ============================ Http response callbacks  ======================== */
-void responseHttpIndex(void *cl, char **matches, int readlen, size_t qblen) {
-    char *argvs[] = {"getNoReplyCommand", stringConcat(PAGE_KEY_PREFIX, "1")};
-    int argc = sizeof(argvs) / sizeof(char*);
+/* Drop the public file at 'path' from both caches, it changed on disk. The
+ * caches of the workers are out of reach of the main thread: they are all
+ * emptied instead. */
+void forgetStaticFile(sds path) {
+    httpLoop *loop = httpLoops;
+    robj *response;
 
-    client *c = (client*) cl;
-    callRedisCommand(c, readlen, qblen, argvs, argc);
+    if (server.http_workers) {
+        emptyStaticFiles();
+        return;
+    }
 
-    if (c->command_last_error) {
-        responseHttpError(c, readlen, qblen, 404);
-    } else {
-        responseHttp(c, c->command_last_reply, "html", 200);
+    if ((response = dictFetchValue(loop->staticMemory, path)) != NULL) {
+        loop->staticMemoryUsed -= sdslen(response->ptr);
+        dictDelete(loop->staticMemory, path);
     }
+
+    dictDelete(loop->staticFiles, path);
+
+    // It may have been remembered as a 404
+    dictEmpty(loop->responseCache, NULL);
 }
 
-void responseHttpPage(void *cl, char **matches, int readlen, size_t qblen) {
-    char *argvs[] = {"getNoReplyCommand", stringConcat(PAGE_KEY_PREFIX, matches[0])};
-    int argc = sizeof(argvs) / sizeof(char*);
+/* Close every cached file and drop the ones kept in memory, on every loop.
+ * Each one does it before it serves its next file, see syncStaticFiles(),
+ * and forgets its cached responses with them. Responses still streaming a
+ * file keep it alive. */
+void emptyStaticFiles(void) {
+    __sync_add_and_fetch(&httpStaticEpoch, 1);
+}
 
-    client *c = (client*) cl;
-    callRedisCommand(c, readlen, qblen, argvs, argc);
+static void syncStaticFiles(httpLoop *loop) {
+    unsigned long epoch = __atomic_load_n(&httpStaticEpoch, __ATOMIC_ACQUIRE);
 
-    if (c->command_last_error) {
-        responseHttpError(c, readlen, qblen, 404);
-    } else {
-        responseHttp(c, c->command_last_reply, "html", 200);
+    if (loop->staticEpoch == epoch) return;
+
+    loop->staticEpoch = epoch;
+    dictEmpty(loop->staticFiles, NULL);
+    dictEmpty(loop->staticMemory, NULL);
+    loop->staticMemoryUsed = 0;
+    dictEmpty(loop->responseCache, NULL);
+}
+
+/* ============================ Response cache  ======================== */
+/* Each loop remembers what a request path was routed to, 404s included
+ * (but for files of public dir), so the next requests of the path skip the
+ * url parsing, the routing and the keyspace lookups. The headers are still parsed: they pick the variant and
+ * may turn it into a 304. Workers borrow the responses from their snapshot
+ * and forget them when they move to the next one, the main loop holds a
+ * reference and forgets them on any write to a blogd:: key. */
+void freeHttpCachedResponse(httpCachedResponse *cached) {
+    if (!cached->borrowed) {
+        decrRefCount(cached->response);
+        if (cached->gzip) decrRefCount(cached->gzip);
     }
+
+    zfree(cached);
 }
 
-void responseHttpContent(void *cl, char **matches, int readlen, size_t qblen) {
-    char *argvs[] = {"getNoReplyCommand", stringConcat(POST_KEY_PREFIX, matches[0])};
-    int argc = sizeof(argvs) / sizeof(char*);
+/* Called by signalModifiedKey() and signalFlushedDb(), with a NULL 'key' */
+void touchHttpResponseCache(robj *key) {
+    if (!httpLoops || !server.response_cache_entries) return;
 
-    client *c = (client*) cl;
-    callRedisCommand(c, readlen, qblen, argvs, argc);
+    if (key && sdsEncodedObject(key) &&
+        strncmp(key->ptr, BLOGD_KEY_PREFIX, sizeof(BLOGD_KEY_PREFIX) - 1)) return;
 
-    if (c->command_last_error) {
-        responseHttpError(c, readlen, qblen, 404);
-    } else {
-        responseHttp(c, c->command_last_reply, "html", 200);
-    }
+    dictEmpty(httpLoops->responseCache, NULL);
 }
 
-void responseHttpError(void *cl, int readlen, size_t qblen, int code) {
-    char errorCode[10];
+/* Set the cacheKey of the loop to the path of the request-target 'uri',
+ * its query string is left out. Returns 0 if the request can't use the
+ * cache: not a plain path, too long, or asking for a reload. */
+static int getHttpResponseCacheKey(httpLoop *loop, const char *uri, size_t len) {
+    const char *query;
 
-    sprintf(errorCode, "%d", code);
+    if (!server.response_cache_entries || !len || uri[0] != '/') return 0;
 
-    char *argvs[] = {"getNoReplyCommand", stringConcat(PAGE_ERROR_KEY_PREFIX, errorCode)};
-    int argc = sizeof(argvs) / sizeof(char*);
+    if ((query = memchr(uri, '?', len)) != NULL) {
+        if (server.reload_content_query) {
+            char *params = dupHttpRequestString(loop, query + 1, uri + len - query - 1);
+            int reload = hasQueryParam(params, server.reload_content_query);
 
-    client *c = (client*) cl;
-    callRedisCommand(c, readlen, qblen, argvs, argc);
+            freeHttpRequest(loop, params);
+            if (reload) return 0;
+        }
 
-    responseHttp(c, c->command_last_reply ? c->command_last_reply : "", "html", code);
-}
+        len = query - uri;
+    }
 
-void responseHttpFile(void *cl, char **matches, int readlen, size_t qblen) {
-    char *filePath;
+    if (len > HTTP_RESPONSE_CACHE_MAX_PATH || memchr(uri, '#', len)) return 0;
 
-    filePath = sdsnew((const char*) server.public_dir);
-    filePath = sdscat(filePath, matches[0]);
-    filePath = sdscat(filePath, ".");
-    filePath = sdscat(filePath, matches[1]);
+    loop->cacheKey = sdscpylen(loop->cacheKey, uri, len);
 
-    client *c = (client*) cl;
+    // Never answered the same twice
+    return !server.metrics_path[0] || strcmp(loop->cacheKey, server.metrics_path);
+}
 
-    char buff[BUFSIZ];
-    struct stat statbuf;
-    int fd, readLength;
+/* Answer the request from the response cache, if its path is there.
+ * Otherwise arm the lookups of its route to fill it, see
+ * storeHttpResponseCache(). */
+static int lookupHttpResponseCache(httpConn *c) {
+    httpLoop *loop = c->loop;
+    httpCachedResponse *cached;
 
-    fd = open(filePath, O_RDONLY);
+    syncStaticFiles(loop);
 
-    if (fd == -1) {
-        responseHttpError(c, readlen, qblen, 404);
-        return;
+    if ((cached = dictFetchValue(loop->responseCache, loop->cacheKey)) == NULL) {
+        loop->responseCacheMisses++;
+        loop->cacheFilling = 1;
+        loop->cacheFill.response = loop->cacheFill.gzip = NULL;
+        return 0;
     }
 
-    fstat(fd, &statbuf);
+    loop->responseCacheHits++;
+    c->route = cached->route;
+    responseHttpObject(c, (c->accept & HTTP_ACCEPT_GZIP) && cached->gzip ? cached->gzip : cached->response,
+                       cached->borrowed);
+    return 1;
+}
+
+/* Remember the responses the route of the request looked up last, the
+ * one it was answered with. Nothing is remembered for a file served from
+ * public dir, or a response that isn't in the keyspace. */
+static void storeHttpResponseCache(httpConn *c) {
+    httpLoop *loop = c->loop;
+    httpCachedResponse *cached;
 
-    c->headers = buildHttpHeaders(matches[1], statbuf.st_size, 200);
+    loop->cacheFilling = 0;
+    if (!loop->cacheFill.response) return;
 
-    addReplyString(c, (const char*) c->headers, sdslen(c->headers));
+    // Full: a random path makes room, the hot ones are soon back
+    if (dictSize(loop->responseCache) >= getStaticCacheShare(server.response_cache_entries)) {
+        dictEntry *de = dictGetRandomKey(loop->responseCache);
 
-    while ((readLength = read(fd, buff, sizeof(buff)))) {
-        addReplyString(c, buff, readLength);
+        if (de) dictDelete(loop->responseCache, dictGetKey(de));
     }
 
-    close(fd);
-}
+    cached = zmalloc(sizeof(*cached));
+    *cached = loop->cacheFill;
+    cached->route = c->route;
+    cached->borrowed = loop->worker;
 
-void responseHttp(void *cl, char *content, char *contentType, unsigned int code) {
-    client *c = (client*) cl;
+    if (!cached->borrowed) {
+        incrRefCount(cached->response);
+        if (cached->gzip) incrRefCount(cached->gzip);
+    }
+
+    dictReplace(loop->responseCache, sdsdup(loop->cacheKey), cached);
+}
 
-    c->headers = buildHttpHeaders(contentType, strlen(content), code);
+/* The response cache counters of every loop */
+static void getResponseCacheCounts(unsigned long *entries, long long *hits, long long *misses) {
+    int i;
 
-    addReplyString(c, (const char*) c->headers, sdslen(c->headers));
-    addReplyString(c, (const char*) content, strlen(content));
+    *entries = *hits = *misses = 0;
+    for (i = 0; i < httpNumLoops; i++) {
+        *entries += dictSize(httpLoops[i].responseCache);
+        *hits += httpLoops[i].responseCacheHits;
+        *misses += httpLoops[i].responseCacheMisses;
+    }
 }
 
-sds *buildHttpHeaders(char *contentType, unsigned int contentLength, unsigned int code) {
-    unsigned int i, length;
-    char *ext;
-    char *headers;
+/* ============================ Init routes  ======================== */
+/* Routes with a hand-written matcher never touch PCRE. Any other route gets
+ * its pattern compiled here once, instead of on every request. */
+void initHttpRoutes(void) {
+    unsigned int i;
 
-    headers = sdsnew("HTTP/1.1 ");
-    ext = (char *)0;
+    httpLookupCommand = lookupCommandByCString("getNoReplyCommand");
 
-    // Find mime type
-    for (i = 0; httpMimes[i].ext != 0; i++) {
-        length = strlen(httpMimes[i].ext);
+    for (i = 0; i < HTTP_NUM_ROUTES; i++) {
+        struct httpRoute *r = httpRoutes + i;
 
-        if (!strncmp(contentType, httpMimes[i].ext, length)) {
-            ext = httpMimes[i].filetype;
-            break;
+        if (!r->matcher && !r->re) {
+            r->re = preg_compile(r->pattern);
         }
     }
+}
 
-    if (ext == 0) {
-        code = 400;
-    }
+static int matchHttpRoute(struct httpRoute *r, char *path, char **matches) {
+    if (r->matcher) return r->matcher(path, matches);
 
-    switch (code) {
-        case 500:
-            ext = "text/html";
-            headers = sdscat(headers, "500 Internal Server Error\r\n");
-            break;
+    return preg_exec(r->re, path, matches, ROUTE_MAX_MATCHES);
+}
 
-        case 404:
-            ext = "text/html";
-            headers = sdscat(headers, "404 Not Found\r\n");
-            break;
+/* ============================ Init contents  ======================== */
+contentIndex *createContentIndex(void) {
+    contentIndex *idx = zmalloc(sizeof(*idx));
+
+    idx->posts = dictCreate(&contentPostDictType, NULL);
+    idx->files = dictCreate(&contentFileDictType, NULL);
+    idx->pages = NULL;
+    idx->numPages = 0;
+    idx->templates = 0;
+    idx->epoch = 0;
+    idx->scanned = 0;
+    return idx;
+}
 
-        case 400:
-            ext = "text/html";
-            headers = sdscat(headers, "400 Bad Request\r\n");
-            break;
+static void freeContentIndex(contentIndex *idx) {
+    dictRelease(idx->posts);
+    dictRelease(idx->files);
+    zfree(idx->pages);
+    zfree(idx);
+}
 
-        default:
-            headers = sdscat(headers, "200 OK\r\n");
-            break;
-    }
+void freeContentPost(contentPost *post) {
+    sdsfree(post->summary);
+    zfree(post);
+}
 
-    headers = sdscat(headers, "Server: Blogd\r\n");
-    headers = sdscat(headers, "Connection: close\r\n");
-    headers = sdscat(headers, "Cache-Control: no-store, must-revalidate\r\n");
-    headers = sdscat(headers, "Pragma: no-cache\r\n");
-    headers = sdscat(headers, "Expires: 0\r\n");
-    headers = sdscat(headers, "x-content-type-options:nosniff\r\n");
-    headers = sdscat(headers, "x-frame-options:SAMEORIGIN\r\n");
-    headers = sdscat(headers, "x-xss-protection:1; mode=block\r\n");
+contentGeneration *createContentGeneration(char *content_dir, char *public_dir) {
+    contentGeneration *gen = zmalloc(sizeof(*gen));
 
-    /* Content length */
-    char contentLengthString[10];
-    sprintf(contentLengthString, "%u", contentLength);
+    gen->contentDir = sdsnew(content_dir);
+    gen->publicDir = sdsnew(public_dir);
+    gen->responses = dictCreate(&dbDictType, NULL);
+    gen->deleted = listCreate();
+    listSetFreeMethod(gen->deleted, (void (*)(void*)) sdsfree);
+    return gen;
+}
 
-    headers = sdscat(headers, "Content-length: ");
-    headers = sdscat(headers, contentLengthString);
-    headers = sdscat(headers, "\r\n");
+void freeContentGeneration(contentGeneration *gen) {
+    sdsfree(gen->contentDir);
+    sdsfree(gen->publicDir);
+    dictRelease(gen->responses);
+    listRelease(gen->deleted);
+    zfree(gen);
+}
 
-    headers = sdscat(headers, "Content-Type: ");
-    headers = sdscat(headers, ext);
+/* Set 'key' to 'response' and its GZIP_KEY_PREFIX variant to 'gzip', or
+ * delete the variant if there is none. Takes ownership of both objects. */
+static void addGenerationResponses(contentGeneration *gen, const char *key, robj *response, robj *gzip) {
+    sds gzipKey = sdscat(sdsnew(GZIP_KEY_PREFIX), key);
 
-    headers = sdscat(headers, "\r\n\r\n");
+    dictReplace(gen->responses, sdsnew(key), response);
 
-    return (sds *) headers;
+    if (gzip) {
+        dictReplace(gen->responses, gzipKey, gzip);
+    } else {
+        listAddNodeTail(gen->deleted, gzipKey);
+    }
 }
 
-/* ============================ Process Http Request  ======================== */
-void processHttpRequestFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
-    int readlen;
-    size_t qblen;
+/* Add a compiled page. Error pages get neither validators nor caching. */
+static void addGenerationResponse(contentGeneration *gen, char *key, char *content, unsigned int code,
+                                  const char *control, time_t lastModified)
+{
+    size_t len = strlen(content);
+    httpCache cache = httpNoCache;
 
-    client *c = (client*) privdata;
+    if (code == 200) initHttpCache(&cache, control, content, len, lastModified);
 
-    UNUSED(el);
-    UNUSED(mask);
+    addGenerationResponses(gen, key,
+        createHttpResponse("html", content, len, code, HTTP_ENCODING_IDENTITY, &cache),
+        createHttpGzipResponse("html", content, len, code, &cache));
+}
 
-    readlen = PROTO_IOBUF_LEN;
-    /* If this is a multi bulk request, and we are processing a bulk reply
-     * that is large enough, try to maximize the probability that the query
-     * buffer contains exactly the SDS string representing the object, even
-     * at the risk of requiring more read(2) calls. This way the function
-     * processMultiBulkBuffer() can avoid copying buffers to create the
-     * Redis Object representing the argument. */
-    if (c->reqtype == PROTO_REQ_MULTIBULK && c->multibulklen && c->bulklen != -1
-        && c->bulklen >= PROTO_MBULK_BIG_ARG)
-    {
-        int remaining = (unsigned)(c->bulklen+2)-sdslen(c->querybuf);
+static void addGenerationDelete(contentGeneration *gen, const char *prefix, const char *suffix) {
+    listAddNodeTail(gen->deleted, sdscat(sdsnew(prefix), suffix));
+    listAddNodeTail(gen->deleted, sdscat(sdscat(sdsnew(GZIP_KEY_PREFIX), prefix), suffix));
+}
 
-        if (remaining < readlen) readlen = remaining;
+/* Swap a compiled generation into the keyspace. It runs between two events
+ * of the main thread, so a request sees either the old site or the new one,
+ * never a mix. Responses still being written keep their old value alive. */
+void applyContentGeneration(contentGeneration *gen) {
+    dictIterator *di;
+    dictEntry *de;
+    listIter li;
+    listNode *ln;
+
+    listRewind(gen->deleted, &li);
+    while ((ln = listNext(&li)) != NULL) {
+        robj *keyobj = createObject(OBJ_STRING, sdsdup(listNodeValue(ln)));
+
+        // As setKey() does below: the response caches drop the key
+        if (dbDelete(server.db, keyobj)) {
+            signalModifiedKey(server.db, keyobj);
+            server.dirty++;
+        }
+        decrRefCount(keyobj);
     }
 
-    qblen = sdslen(c->querybuf);
+    di = dictGetIterator(gen->responses);
+    while ((de = dictNext(di)) != NULL) {
+        robj *keyobj = createObject(OBJ_STRING, sdsdup(dictGetKey(de)));
 
-    if (c->querybuf_peak < qblen) c->querybuf_peak = qblen;
+        setKey(server.db, keyobj, dictGetVal(de));
+        server.dirty++;
+        decrRefCount(keyobj);
+    }
+    dictReleaseIterator(di);
 
-    /* Http request */
-    c->http_querybuf = sdsMakeRoomFor(c->http_querybuf, readlen);
-    int httpRequestLength = read(fd, c->http_querybuf + qblen, readlen);
+    freeContentGeneration(gen);
+    publishHttpSnapshot();
+}
 
-    if (httpRequestLength == -1) {
-        if (errno == EAGAIN) {
-            return;
-        } else {
-            serverLog(LL_VERBOSE, "Reading from client: %s",strerror(errno));
-            freeClient(c);
-            return;
-        }
-    } else if (httpRequestLength == 0) {
-        serverLog(LL_VERBOSE, "Client closed connection");
-        freeClient(c);
-        return;
-    }
+static uint64_t crc64Sds(uint64_t crc, const char *s) {
+    return crc64(crc, (const unsigned char*) s, sdslen((sds) s));
+}
 
-    sdsIncrLen(c->http_querybuf, httpRequestLength);
+static uint64_t crc64Long(uint64_t crc, unsigned long long value) {
+    return crc64(crc, (const unsigned char*) &value, sizeof(value));
+}
 
-    RequestHeader *header;
-    header = h3_request_header_new();
-    h3_request_header_parse(header, c->http_querybuf, httpRequestLength);
+static uint64_t crc64String(uint64_t crc, const char *s) {
+    return crc64(crc, (const unsigned char*) s, strlen(s));
+}
 
-    if (strncmp(header->RequestMethod, "GET ", 4) && strncmp(header->RequestMethod, "get ", 4)) {
-        h3_request_header_free(header);
-        responseHttp(c, "", "", 400);
-        return;
-    }
+/* ============================ Content manifest  ======================== */
+/* What compileContents() knows of the sources, stored at CONTENT_MANIFEST_KEY
+ * by the generation compiled from them: it is saved in the RDB along with
+ * the responses it describes, never one without the other. A restart takes
+ * it back, see restoreContents(), and only compiles what changed since.
+ * Numbers are 64 bits in host byte order, strings are prefixed by their
+ * length. */
+static sds catManifestLong(sds s, uint64_t value) {
+    return sdscatlen(s, &value, sizeof(value));
+}
 
-    struct http_parser_url u;
-    char* fullUrl = strndup(header->RequestURI, header->RequestURILen);
+static sds catManifestString(sds s, const char *str, size_t len) {
+    return sdscatlen(catManifestLong(s, len), str, len);
+}
 
-    // Free header
-    h3_request_header_free(header);
+static robj *createContentManifest(contentGeneration *gen, contentIndex *idx) {
+    sds s = sdsempty();
+    dictIterator *di;
+    dictEntry *de;
+    unsigned long i;
+
+    s = catManifestLong(s, CONTENT_MANIFEST_VERSION);
+    s = catManifestString(s, gen->contentDir, sdslen(gen->contentDir));
+    s = catManifestString(s, gen->publicDir, sdslen(gen->publicDir));
+    s = catManifestLong(s, idx->templates);
+    s = catManifestLong(s, crc64String(0, server.cache_control_static));
+    s = catManifestLong(s, idx->scanned);
+
+    s = catManifestLong(s, idx->numPages);
+    for (i = 0; i < idx->numPages; i++) s = catManifestLong(s, idx->pages[i]);
+
+    s = catManifestLong(s, dictSize(idx->posts));
+    di = dictGetIterator(idx->posts);
+    while ((de = dictNext(di)) != NULL) {
+        sds name = dictGetKey(de);
+        contentPost *post = dictGetVal(de);
+
+        s = catManifestString(s, name, sdslen(name));
+        s = catManifestLong(s, post->mtime);
+        s = catManifestLong(s, post->size);
+        s = catManifestLong(s, post->hash);
+        s = catManifestLong(s, post->summaryHash);
+        s = catManifestString(s, post->summary, sdslen(post->summary));
+    }
+    dictReleaseIterator(di);
 
-    // Parse url
-    if (http_parser_parse_url(fullUrl, strlen(fullUrl), 0, &u)) {
-        free(fullUrl); fullUrl = NULL;
-        responseHttp(c, "", "", 400);
-        return;
+    s = catManifestLong(s, dictSize(idx->files));
+    di = dictGetIterator(idx->files);
+    while ((de = dictNext(di)) != NULL) {
+        sds path = dictGetKey(de);
+        contentFile *cf = dictGetVal(de);
+
+        s = catManifestString(s, path, sdslen(path));
+        s = catManifestLong(s, cf->mtime);
+        s = catManifestLong(s, cf->size);
     }
+    dictReleaseIterator(di);
 
-    char *urlPath = strndup(fullUrl + u.field_data[UF_PATH].off, u.field_data[UF_PATH].len);
-    char *urlQuery = strndup(fullUrl + u.field_data[UF_QUERY].off, u.field_data[UF_QUERY].len);
+    return createObject(OBJ_STRING, s);
+}
+
+typedef struct manifestReader {
+    const char *p;
+    const char *end;
+} manifestReader;
+
+static int readManifestLong(manifestReader *r, uint64_t *value) {
+    if ((size_t) (r->end - r->p) < sizeof(*value)) return 0;
+
+    memcpy(value, r->p, sizeof(*value));
+    r->p += sizeof(*value);
+    return 1;
+}
+
+/* NULL if the manifest is cut short */
+static sds readManifestString(manifestReader *r) {
+    uint64_t len;
+    sds s;
 
-    // Check if it has reload action
-    char **matches = preg_match(server.reload_content_query, urlQuery);
+    if (!readManifestLong(r, &len) || len > (uint64_t) (r->end - r->p)) return NULL;
+
+    s = sdsnewlen(r->p, len);
+    r->p += len;
+    return s;
+}
 
-    if (matches) {
-        initContents(server.content_dir);
+/* Parse the manifest 'o' into a new index, as if it was just compiled.
+ * NULL if it is corrupt, of another version or compiled from other dirs.
+ * The public files are left out when cache-control-static changed: their
+ * gzip variants are compressed again with the new headers. */
+static contentIndex *loadContentManifest(robj *o) {
+    manifestReader r = {o->ptr, (char*) o->ptr + sdslen(o->ptr)};
+    contentIndex *idx = createContentIndex();
+    sds contentDir = NULL, publicDir = NULL, name = NULL, summary = NULL;
+    uint64_t version, statics, scanned, count, i, v[4];
+    int valid = 0;
+
+    if (!readManifestLong(&r, &version) || version != CONTENT_MANIFEST_VERSION) goto cleanup;
+    if ((contentDir = readManifestString(&r)) == NULL || strcmp(contentDir, server.content_dir)) goto cleanup;
+    if ((publicDir = readManifestString(&r)) == NULL || strcmp(publicDir, server.public_dir)) goto cleanup;
+    if (!readManifestLong(&r, &idx->templates) || !readManifestLong(&r, &statics) ||
+        !readManifestLong(&r, &scanned)) goto cleanup;
+
+    idx->scanned = scanned;
+    idx->epoch = 1;
+
+    if (!readManifestLong(&r, &count) || count > (uint64_t) (r.end - r.p) / sizeof(uint64_t)) goto cleanup;
+
+    idx->pages = zmalloc(sizeof(uint64_t) * (count + 1));
+    idx->numPages = count;
+    for (i = 0; i < count; i++) {
+        if (!readManifestLong(&r, idx->pages + i)) goto cleanup;
     }
 
-    zfree(matches); matches = NULL;
+    if (!readManifestLong(&r, &count)) goto cleanup;
 
-    unsigned int numRoutes = sizeof(httpRoutes) / sizeof(struct httpRoute);
-    unsigned int i;
-    unsigned int isMatched = 0;
+    for (i = 0; i < count; i++) {
+        contentPost *post;
 
-    // Find matched route
-    for (i = 0; i < numRoutes; i++) {
-        struct httpRoute *r = httpRoutes + i;
-        char **matches = preg_match(r->pattern, urlPath);
+        if ((name = readManifestString(&r)) == NULL) goto cleanup;
+        if (!readManifestLong(&r, v) || !readManifestLong(&r, v + 1) || !readManifestLong(&r, v + 2) ||
+            !readManifestLong(&r, v + 3)) goto cleanup;
+        if ((summary = readManifestString(&r)) == NULL) goto cleanup;
 
-        if (matches) {
-            isMatched = 1;
-            r->callback(c, matches, readlen, qblen);
-            break;
+        post = zcalloc(sizeof(*post));
+        post->mtime = v[0];
+        post->size = v[1];
+        post->hash = v[2];
+        post->summaryHash = v[3];
+        post->summary = summary;
+        post->epoch = idx->epoch;
+        summary = NULL;
+
+        if (dictAdd(idx->posts, name, post) != DICT_OK) {
+            freeContentPost(post);
+            goto cleanup;
         }
+        name = NULL;
     }
 
-    zfree(matches); matches = NULL;
+    if (!readManifestLong(&r, &count)) goto cleanup;
 
-    free(fullUrl); fullUrl = NULL;
-    free(urlPath); urlPath = NULL;
-    free(urlQuery); urlQuery = NULL;
+    for (i = 0; i < count; i++) {
+        contentFile *cf;
 
-    if (!isMatched) {
-        responseHttpError(c, readlen, qblen, 404);
+        if ((name = readManifestString(&r)) == NULL) goto cleanup;
+        if (!readManifestLong(&r, v) || !readManifestLong(&r, v + 1)) goto cleanup;
+
+        cf = zmalloc(sizeof(*cf));
+        cf->mtime = v[0];
+        cf->size = v[1];
+        cf->epoch = idx->epoch;
+
+        if (dictAdd(idx->files, name, cf) != DICT_OK) {
+            zfree(cf);
+            goto cleanup;
+        }
+        name = NULL;
+    }
+
+    valid = r.p == r.end;
+    if (statics != crc64String(0, server.cache_control_static)) dictEmpty(idx->files, NULL);
+
+cleanup:
+    sdsfree(contentDir);
+    sdsfree(publicDir);
+    sdsfree(name);
+    sdsfree(summary);
+
+    if (!valid) {
+        freeContentIndex(idx);
+        return NULL;
+    }
+
+    return idx;
+}
+
+/* Take server.contents back from the manifest loaded with the dataset,
+ * less what the keyspace lost since: a post whose response is gone is
+ * compiled again, a missing pagination page rebuilds them all, a missing
+ * error page everything. Returns 0 if there is no usable manifest. */
+static int restoreContents(void) {
+    static const char *errorCodes[] = {"400", "404", "500"};
+    robj *keyobj = createStringObject(CONTENT_MANIFEST_KEY, strlen(CONTENT_MANIFEST_KEY));
+    robj *o = lookupKeyRead(server.db, keyobj);
+    contentIndex *idx;
+    dictIterator *di;
+    dictEntry *de;
+    unsigned long i;
+    sds key;
+
+    decrRefCount(keyobj);
+
+    if (!o || o->type != OBJ_STRING || !sdsEncodedObject(o)) return 0;
+
+    if ((idx = loadContentManifest(o)) == NULL) {
+        serverLog(LL_NOTICE, "The content manifest of the dataset can't be used, compiling everything");
+        return 0;
+    }
+
+    key = sdsempty();
+
+    di = dictGetSafeIterator(idx->posts);
+    while ((de = dictNext(di)) != NULL) {
+        key = sdscatsds(sdscpy(key, POST_KEY_PREFIX), dictGetKey(de));
+        if (!dictFind(server.db->dict, key)) dictDelete(idx->posts, dictGetKey(de));
+    }
+    dictReleaseIterator(di);
+
+    for (i = 0; i < idx->numPages; i++) {
+        key = sdscatfmt(sdscpy(key, PAGE_KEY_PREFIX), "%U", (unsigned long long) i + 1);
+        if (!dictFind(server.db->dict, key)) {
+            idx->numPages = 0;
+            break;
+        }
+    }
+
+    for (i = 0; i < sizeof(errorCodes) / sizeof(char*); i++) {
+        key = sdscat(sdscpy(key, PAGE_ERROR_KEY_PREFIX), errorCodes[i]);
+        if (!dictFind(server.db->dict, key)) idx->templates = 0;
+    }
+
+    sdsfree(key);
+
+    freeContentIndex(server.contents);
+    server.contents = idx;
+
+    serverLog(LL_NOTICE, "Contents restored from the dataset: %lu posts, %lu pages, %lu public files compressed",
+        dictSize(idx->posts), idx->numPages, dictSize(idx->files));
+    return 1;
+}
+
+/* Compile a post page and the summary it shows in the pagination pages.
+ * Only touches 'post', so posts can be compiled on several threads. */
+static robj *compileContentPost(contentPost *post, char *fileName, char *fileContent,
+                                template *layout, template *summary, time_t lastModified, robj **gzip)
+{
+    compiledObj *obj = compileTemplate(fileContent, layout, server.markdown_compile, server.markdown_extensions, 1);
+    size_t len = sdslen(obj->compiled_content);
+    httpCache cache;
+
+    initHttpCache(&cache, server.cache_control_posts, obj->compiled_content, len, lastModified);
+
+    robj *response = createHttpResponse("html", obj->compiled_content, len, 200, HTTP_ENCODING_IDENTITY, &cache);
+
+    *gzip = createHttpGzipResponse("html", obj->compiled_content, len, 200, &cache);
+
+    // Compile post content
+    sds link = sdscat(sdsnew("/"), fileName);
+    templateVar linkVar = {"link", link, sdslen(link)};
+
+    sdsfree(post->summary);
+    post->summary = renderContentSections(summary, obj->sections, &linkVar, 1);
+    post->summaryHash = crc64Sds(0, post->summary);
+
+    sdsfree(link); link = NULL;
+    freeCompiledObj(obj); obj = NULL;
+
+    return response;
+}
+
+/* A post file to check, and to compile if it changed */
+typedef struct contentTask {
+    contentPost *post;
+    sds name;           /* File name without extension */
+    sds path;
+    time_t mtime;
+    off_t size;
+    robj *response;     /* Compiled post page, NULL if the post did not change */
+    robj *gzip;         /* Its gzip variant, if smaller */
+    int unreadable;     /* Gone or unreadable since the scan, the post is removed */
+} contentTask;
+
+typedef struct contentTasks {
+    contentTask *tasks;
+    template *layout;
+    template *summary;
+    time_t templatesMtime; /* Latest change of the templates */
+    time_t lastScan;       /* Start of the previous load */
+    int full;
+} contentTasks;
+
+/* Run on the compile threads, see runParallel(). A task only writes its
+ * own post and response: the generation and the index are left to the
+ * calling thread. */
+static void runContentTask(void *ctx, unsigned long i) {
+    contentTasks *ct = ctx;
+    contentTask *task = ct->tasks + i;
+    contentPost *post = task->post;
+
+    if (!ct->full && post->epoch != 0 && post->mtime == task->mtime && post->size == task->size &&
+        post->mtime < ct->lastScan) return;
+
+    char *fileContent = readFileContent(task->path);
+
+    if (!fileContent) {
+        serverLog(LL_WARNING, "Can't read file '%s': %s", task->path, strerror(errno));
+        task->unreadable = 1;
+        return;
+    }
+
+    uint64_t hash = crc64Sds(0, fileContent);
+
+    if (ct->full || post->epoch == 0 || post->hash != hash) {
+        serverLog(LL_NOTICE, "Compile file '%s'...", task->path);
+
+        task->response = compileContentPost(post, task->name, fileContent, ct->layout, ct->summary,
+            task->mtime > ct->templatesMtime ? task->mtime : ct->templatesMtime, &task->gzip);
+    }
+
+    post->mtime = task->mtime;
+    post->size = task->size;
+    post->hash = hash;
+
+    sdsfree(fileContent); fileContent = NULL;
+}
+
+/* Compile pagination page 'pageIndex' listing 'count' posts. It was last
+ * modified with the latest of them, or with the templates. */
+static void compileContentPage(contentGeneration *gen, unsigned long pageIndex, contentPost **posts,
+                               unsigned long count, int hasMore, template *layout, template *page,
+                               time_t lastModified)
+{
+    char pageNumString[LONG_STR_SIZE];
+    size_t postsLen = 0;
+    unsigned long i;
+
+    for (i = 0; i < count; i++) {
+        postsLen += sdslen(posts[i]->summary);
+        if (posts[i]->mtime > lastModified) lastModified = posts[i]->mtime;
+    }
+
+    sds postsContents = sdsMakeRoomFor(sdsempty(), postsLen);
+    for (i = 0; i < count; i++) postsContents = sdscatsds(postsContents, posts[i]->summary);
+
+    sds moreHtml = sdsempty();
+    if (hasMore) {
+        moreHtml = sdscatfmt(moreHtml, "<ul class='pager'><li class='next'><a href='/page/%U'>More</a></li></ul>",
+            (unsigned long long) pageIndex + 1);
+    }
+
+    // Re-assign index content
+    templateVar vars[] = {
+        {"posts", postsContents, sdslen(postsContents)},
+        {"more", moreHtml, sdslen(moreHtml)}
+    };
+    sds pageCompiledContent = renderTemplate(page, vars, 2);
+
+    ll2string(pageNumString, sizeof(pageNumString), pageIndex);
+
+    // Compile template
+    compiledObj *obj = compileTemplate(pageCompiledContent, layout, server.markdown_compile, server.markdown_extensions, 0);
+
+    char *pageKey = stringConcat(PAGE_KEY_PREFIX, pageNumString);
+    addGenerationResponse(gen, pageKey, obj->compiled_content, 200, server.cache_control_pages, lastModified);
+    zfree(pageKey); pageKey = NULL;
+
+    sdsfree(postsContents);
+    sdsfree(moreHtml);
+    freeCompiledObj(obj); obj = NULL;
+    sdsfree(pageCompiledContent); pageCompiledContent = NULL;
+}
+
+/* Read a whole public file, binary safe. NULL on error. */
+static sds readStaticFile(const char *path, off_t size) {
+    sds content = sdsnewlen(NULL, size);
+    off_t done = 0;
+    ssize_t n;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) == -1) {
+        sdsfree(content);
+        return NULL;
+    }
+
+    while (done < size && (n = read(fd, content + done, size - done)) > 0) done += n;
+    close(fd);
+
+    if (done != size) {
+        sdsfree(content);
+        return NULL;
+    }
+
+    return content;
+}
+
+/* Walk 'dir', served at 'urlPath', for the compressible files whose mtime
+ * or size changed since the last load and store their gzip variant. The
+ * uncompressed body is still sent with sendfile(2), see responseHttpFile().
+ * C_ERR if a directory could not be opened: the files below it were not
+ * seen, they must not be forgotten. */
+static int compileStaticDir(contentGeneration *gen, const char *dir, sds urlPath, int depth,
+                            time_t lastScan, unsigned long *numCompressed)
+{
+    contentIndex *idx = server.contents;
+    tinydir_dir tdir;
+    int retval = C_OK;
+
+    // Symbolic links are followed, don't loop forever on a cycle
+    if (depth > HTTP_STATIC_MAX_DEPTH) return C_OK;
+
+    if (tinydir_open(&tdir, dir) == -1) {
+        serverLog(LL_WARNING, "Can't open the public directory %s: %s", dir, strerror(errno));
+        return C_ERR;
+    }
+
+    for (; tdir.has_next; tinydir_next(&tdir)) {
+        tinydir_file file;
+
+        if (tinydir_readfile(&tdir, &file) == -1) continue;
+        if (file.name[0] == '.') continue;
+
+        sds path = sdscat(sdscat(sdsdup(urlPath), "/"), file.name);
+
+        if (file.is_dir) {
+            if (compileStaticDir(gen, file.path, path, depth + 1, lastScan, numCompressed) == C_ERR) {
+                retval = C_ERR;
+            }
+        } else if (file.is_reg && isHttpCompressible(file.extension) && file._s.st_size <= HTTP_GZIP_MAX_FILE) {
+            contentFile *cf = dictFetchValue(idx->files, path);
+
+            if (!cf) {
+                cf = zcalloc(sizeof(contentFile));
+                dictAdd(idx->files, sdsdup(path), cf);
+            }
+
+            if (cf->epoch == 0 || cf->mtime != file._s.st_mtime || cf->size != file._s.st_size ||
+                cf->mtime >= lastScan) {
+                sds content = readStaticFile(file.path, file._s.st_size);
+                robj *gzip = NULL;
+
+                if (content) {
+                    httpCache cache;
+
+                    initStaticFileCache(&cache, file._s.st_mtime, file._s.st_size);
+                    cache.ranges = 0;
+                    gzip = createHttpGzipResponse(file.extension, content, sdslen(content), 200, &cache);
+                }
+
+                sds key = sdscatsds(sdsnew(GZIP_KEY_PREFIX STATIC_KEY_PREFIX), path);
+                if (gzip) {
+                    dictReplace(gen->responses, key, gzip);
+                    (*numCompressed)++;
+                } else {
+                    listAddNodeTail(gen->deleted, key);
+                }
+
+                cf->mtime = file._s.st_mtime;
+                cf->size = file._s.st_size;
+                sdsfree(content);
+            }
+
+            cf->epoch = idx->epoch;
+        }
+
+        sdsfree(path);
+    }
+
+    tinydir_close(&tdir);
+    return retval;
+}
+
+/* Compile the contents into 'gen', a set of pre-serialized responses to
+ * swap in with applyContentGeneration(). This only reads server.contents
+ * and the files, so it can run on a bio thread. The first call compiles
+ * everything. Later calls (content reloads) compare each post
+ * with what server.contents remembers: files whose mtime and size did not
+ * change are skipped, unless that mtime is as recent as the previous load,
+ * the others are re-read and only recompiled if their crc64 differs. Only pagination pages whose list of summaries changed
+ * are rebuilt, keys of deleted posts and vanished pages are removed. Any
+ * template or page setting change recompiles everything. */
+int compileContents(contentGeneration *gen) {
+    contentIndex *idx = server.contents;
+    contentPost **posts = NULL;
+    template *layout = NULL, *summary = NULL, *page = NULL;
+    unsigned long i;
+    char *content_dir = gen->contentDir;
+    int retval = C_ERR;
+    char *contentPath = stringConcat(content_dir, "/posts/");
+
+    char *layoutFilePath = stringConcat(content_dir, "/layout.tpl");
+    char *headerFilePath = stringConcat(content_dir, "/header.tpl");
+    char *contentTopFilePath = stringConcat(content_dir, "/content_top.tpl");
+    char *footerFilePath = stringConcat(content_dir, "/footer.tpl");
+    char *postFilePath = stringConcat(content_dir, "/post.tpl");
+    char *pageFilePath = stringConcat(content_dir, "/page.tpl");
+
+    char *error400FilePath = stringConcat(content_dir, "/errors/400.tpl");
+    char *error404FilePath = stringConcat(content_dir, "/errors/404.tpl");
+    char *error500FilePath = stringConcat(content_dir, "/errors/500.tpl");
+
+    char *layoutContent = readFileContent(layoutFilePath);
+    char *headerContent = readFileContent(headerFilePath);
+    char *topContent = readFileContent(contentTopFilePath);
+    char *footerContent = readFileContent(footerFilePath);
+    char *postContent = readFileContent(postFilePath);
+    char *pageContent = readFileContent(pageFilePath);
+
+    char *error400Content = readFileContent(error400FilePath);
+    char *error404Content = readFileContent(error404FilePath);
+    char *error500Content = readFileContent(error500FilePath);
+    
+    if (!layoutContent || !headerContent || !topContent || !footerContent || !postContent || !pageContent) {
+        serverLog(LL_WARNING, "PLEASE CHECK CONTENTS DIRECTORY PATH: There is not enough files to run");
+        goto cleanup;
+    }
+
+    if (!error400Content || !error404Content || !error500Content) {
+        serverLog(LL_WARNING, "PLEASE CHECK ERRORS DIRECTORY PATH: There is not enough files to run");
+        goto cleanup;
+    }
+
+    // Nothing is changed yet: when a directory can't be read, the current
+    // contents stay published rather than losing every post or public file
+    tinydir_dir dir, publicDir;
+
+    if (tinydir_open(&publicDir, gen->publicDir) == -1) {
+        serverLog(LL_WARNING, "Can't open the public directory %s: %s", gen->publicDir, strerror(errno));
+        goto cleanup;
+    }
+    tinydir_close(&publicDir);
+
+    if (tinydir_open_sorted(&dir, contentPath) == -1) {
+        serverLog(LL_WARNING, "Can't read the posts directory %s: %s", contentPath, strerror(errno));
+        goto cleanup;
+    }
+
+    // Every compiled response depends on these
+    uint64_t templates = 0;
+    templates = crc64Sds(templates, layoutContent);
+    templates = crc64Sds(templates, headerContent);
+    templates = crc64Sds(templates, topContent);
+    templates = crc64Sds(templates, footerContent);
+    templates = crc64Sds(templates, postContent);
+    templates = crc64Sds(templates, pageContent);
+    templates = crc64Sds(templates, error400Content);
+    templates = crc64Sds(templates, error404Content);
+    templates = crc64Sds(templates, error500Content);
+    templates = crc64Long(templates, server.per_page);
+    templates = crc64Long(templates, server.markdown_compile);
+    templates = crc64Long(templates, server.markdown_extensions);
+
+    // Baked into the stored headers, they may change across a restart
+    templates = crc64String(templates, server.cache_control_pages);
+    templates = crc64String(templates, server.cache_control_posts);
+
+    int full = idx->epoch == 0 || templates != idx->templates;
+
+    // Pages are as new as the latest template they are built with
+    char *templatePaths[] = {layoutFilePath, headerFilePath, contentTopFilePath, footerFilePath,
+                             postFilePath, pageFilePath};
+    time_t templatesMtime = 0;
+
+    for (i = 0; i < sizeof(templatePaths) / sizeof(char*); i++) {
+        struct stat statbuf;
+
+        if (stat(templatePaths[i], &statbuf) == 0 && statbuf.st_mtime > templatesMtime) {
+            templatesMtime = statbuf.st_mtime;
+        }
+    }
+
+    time_t lastScan = idx->scanned;
+
+    idx->templates = templates;
+    idx->epoch++;
+    idx->scanned = time(NULL);
+
+    // Parse the templates once, the includes are filled into the layout right away
+    templateVar includes[] = {
+        {"include header", headerContent, sdslen(headerContent)},
+        {"include content_top", topContent, sdslen(topContent)},
+        {"include footer", footerContent, sdslen(footerContent)}
+    };
+    template *rawLayout = parseTemplate(layoutContent);
+    sds layoutSource = renderTemplate(rawLayout, includes, 3);
+
+    layout = parseTemplate(layoutSource);
+    summary = parseTemplate(postContent);
+    page = parseTemplate(pageContent);
+
+    freeTemplate(rawLayout);
+    sdsfree(layoutSource);
+
+    if (full) {
+        // Init 400 error page
+        compiledObj *obj400 = compileTemplate(error400Content, layout, server.markdown_compile,
+                                              server.markdown_extensions, 1);
+        char *key400 = stringConcat(PAGE_ERROR_KEY_PREFIX, "400");
+        addGenerationResponse(gen, key400, obj400->compiled_content, 400, NULL, 0);
+        zfree(key400);
+        freeCompiledObj(obj400); obj400 = NULL;
+
+        // Init 404 error page
+        compiledObj *obj404 = compileTemplate(error404Content, layout, server.markdown_compile,
+                                              server.markdown_extensions, 1);
+        char *key404 = stringConcat(PAGE_ERROR_KEY_PREFIX, "404");
+        addGenerationResponse(gen, key404, obj404->compiled_content, 404, NULL, 0);
+        zfree(key404);
+        freeCompiledObj(obj404); obj404 = NULL;
+
+        // Init 500 error page
+        compiledObj *obj500 = compileTemplate(error500Content, layout, server.markdown_compile,
+                                              server.markdown_extensions, 1);
+        char *key500 = stringConcat(PAGE_ERROR_KEY_PREFIX, "500");
+        addGenerationResponse(gen, key500, obj500->compiled_content, 500, NULL, 0);
+        zfree(key500);
+        freeCompiledObj(obj500); obj500 = NULL;
+    }
+
+    unsigned long numPosts = 0, numCompiled = 0, numRemoved = 0, numPages, numPagesBuilt = 0;
+
+    contentTasks ct = {NULL, layout, summary, templatesMtime, lastScan, full};
+    ct.tasks = zcalloc(sizeof(contentTask) * (dir.n_files + 1));
+
+    for (i = 0; i < dir.n_files; i++) {
+        tinydir_file file;
+        tinydir_readfile_n(&dir, &file, i);
+
+        // Nor hidden files and editor backups: post.md~ would be the post
+        if (file.is_dir || file.name[0] == '.' || file.name[strlen(file.name) - 1] == '~') continue;
+
+        char *fileName = removeFileExt(file.name, '.', '/');
+        sds name = sdsnew(fileName);
+        contentPost *post = dictFetchValue(idx->posts, name);
+
+        zfree(fileName); fileName = NULL;
+
+        // post.md and post.markdown are the same post: one task each, the
+        // first file in the (descending) order wins
+        if (post && post->queued) {
+            serverLog(LL_WARNING, "Skip file '%s': another file is already compiled as post '%s'",
+                file.path, name);
+            sdsfree(name);
+            continue;
+        }
+
+        if (!post) {
+            post = zcalloc(sizeof(contentPost));
+            post->summary = sdsempty();
+            dictAdd(idx->posts, sdsdup(name), post);
+        }
+
+        post->queued = 1;
+
+        contentTask *task = ct.tasks + numPosts++;
+
+        task->name = name;
+        task->path = sdsnew(file.path);
+        task->mtime = file._s.st_mtime;
+        task->size = file._s.st_size;
+        task->post = post;
+    }
+
+    tinydir_close(&dir);
+
+    // Posts do not depend on each other, check and compile them in parallel
+    runParallel(numPosts, server.compile_threads, runContentTask, &ct);
+
+    // Then collect them in file order, the pagination below depends on it.
+    // An unreadable post keeps its old epoch, it is removed below.
+    posts = zmalloc(sizeof(contentPost*) * (numPosts + 1));
+    unsigned long numTasks = numPosts;
+
+    for (numPosts = 0, i = 0; i < numTasks; i++) {
+        contentTask *task = ct.tasks + i;
+
+        task->post->queued = 0;
+
+        if (task->unreadable) {
+            sdsfree(task->name);
+            sdsfree(task->path);
+            continue;
+        }
+
+        if (task->response) {
+            sds postKey = sdscatsds(sdsnew(POST_KEY_PREFIX), task->name);
+
+            addGenerationResponses(gen, postKey, task->response, task->gzip);
+            sdsfree(postKey);
+            numCompiled++;
+        }
+
+        task->post->epoch = idx->epoch;
+        posts[numPosts++] = task->post;
+
+        sdsfree(task->name);
+        sdsfree(task->path);
+    }
+
+    zfree(ct.tasks); ct.tasks = NULL;
+
+    // Forget the posts whose file is gone, a post never compiled has no key
+    dictIterator *di = dictGetSafeIterator(idx->posts);
+    dictEntry *de;
+
+    while ((de = dictNext(di)) != NULL) {
+        contentPost *post = dictGetVal(de);
+
+        if (post->epoch != idx->epoch) {
+            if (post->epoch != 0) {
+                addGenerationDelete(gen, POST_KEY_PREFIX, dictGetKey(de));
+                numRemoved++;
+            }
+            dictDelete(idx->posts, dictGetKey(de));
+        }
+    }
+
+    dictReleaseIterator(di);
+
+    // Rebuild the pagination pages whose content changed
+    numPages = (numPosts + server.per_page - 1) / server.per_page;
+    uint64_t *pages = zmalloc(sizeof(uint64_t) * (numPages + 1));
+
+    for (i = 0; i < numPages; i++) {
+        unsigned long first = i * server.per_page, count = numPosts - first, j;
+        int hasMore = count > server.per_page;
+
+        if (hasMore) count = server.per_page;
+
+        pages[i] = crc64Long(0, hasMore);
+        for (j = 0; j < count; j++) pages[i] = crc64Long(pages[i], posts[first + j]->summaryHash);
+
+        if (full || i >= idx->numPages || pages[i] != idx->pages[i]) {
+            compileContentPage(gen, i + 1, posts + first, count, hasMore, layout, page, templatesMtime);
+            numPagesBuilt++;
+        }
+    }
+
+    for (i = numPages; i < idx->numPages; i++) {
+        char pageNumString[LONG_STR_SIZE];
+
+        ll2string(pageNumString, sizeof(pageNumString), i + 1);
+        addGenerationDelete(gen, PAGE_KEY_PREFIX, pageNumString);
+    }
+
+    zfree(idx->pages);
+    idx->pages = pages;
+    idx->numPages = numPages;
+
+    // Precompress the public files, and forget the ones that are gone,
+    // unless a directory could not be walked
+    unsigned long numCompressed = 0;
+    sds publicRoot = sdsempty();
+    int publicWalked = compileStaticDir(gen, gen->publicDir, publicRoot, 0, lastScan, &numCompressed) == C_OK;
+
+    sdsfree(publicRoot);
+
+    di = dictGetSafeIterator(idx->files);
+
+    while ((de = dictNext(di)) != NULL) {
+        contentFile *cf = dictGetVal(de);
+
+        if (publicWalked && cf->epoch != idx->epoch) {
+            listAddNodeTail(gen->deleted, sdscatsds(sdsnew(GZIP_KEY_PREFIX STATIC_KEY_PREFIX), dictGetKey(de)));
+            dictDelete(idx->files, dictGetKey(de));
+        }
+    }
+
+    dictReleaseIterator(di);
+
+    // Saved with the responses above, see restoreContents()
+    dictReplace(gen->responses, sdsnew(CONTENT_MANIFEST_KEY), createContentManifest(gen, idx));
+
+    serverLog(LL_NOTICE, "Contents loaded: %lu posts, %lu compiled, %lu removed, %lu/%lu pages rebuilt, "
+        "%lu public files compressed", numPosts, numCompiled, numRemoved, numPagesBuilt, numPages, numCompressed);
+    retval = C_OK;
+
+cleanup:
+    zfree(posts); posts = NULL;
+    zfree(contentPath); contentPath = NULL;
+    zfree(layoutFilePath); layoutFilePath = NULL;
+    zfree(headerFilePath); headerFilePath = NULL;
+    zfree(contentTopFilePath); contentTopFilePath = NULL;
+    zfree(footerFilePath); footerFilePath = NULL;
+    zfree(postFilePath); postFilePath = NULL;
+    zfree(pageFilePath); pageFilePath = NULL;
+    zfree(error400FilePath); error400FilePath = NULL;
+    zfree(error404FilePath); error404FilePath = NULL;
+    zfree(error500FilePath); error500FilePath = NULL;
+    freeTemplate(layout); layout = NULL;
+    freeTemplate(summary); summary = NULL;
+    freeTemplate(page); page = NULL;
+
+    sdsfree(layoutContent); layoutContent = NULL;
+    sdsfree(headerContent); headerContent = NULL;
+    sdsfree(topContent); topContent = NULL;
+    sdsfree(footerContent); footerContent = NULL;
+    sdsfree(postContent); postContent = NULL;
+    sdsfree(pageContent); pageContent = NULL;
+    sdsfree(error400Content); error400Content = NULL;
+    sdsfree(error404Content); error404Content = NULL;
+    sdsfree(error500Content); error500Content = NULL;
+
+    return retval;
+}
+
+/* Startup load: compile on the main thread and swap in right away. When
+ * the dataset brought the compiled contents back they are served at once,
+ * only the sources changed since are compiled, in the background. */
+void initContents(char *content_dir) {
+    contentGeneration *gen;
+
+    if (restoreContents()) {
+        reloadContents();
+        return;
+    }
+
+    gen = createContentGeneration(content_dir, server.public_dir);
+    if (compileContents(gen) == C_ERR) exit(1);
+    applyContentGeneration(gen);
+}
+
+/* ============================ Reload contents  ======================== */
+static pthread_mutex_t contentsLock = PTHREAD_MUTEX_INITIALIZER;
+static contentGeneration *contentsCompiled; /* Done by the bio thread, not applied yet */
+static int contentsDone;                    /* Set by the bio thread, under contentsLock */
+static int contentsCompiling;               /* A compile job is queued or running */
+static int contentsReloadPending;           /* Reload asked while compiling */
+static int contentsReloadAsked;             /* By a request served in a worker, atomically */
+
+/* Ask for a reload without blocking the event loop: the contents are
+ * compiled by a bio thread while requests keep being served from the
+ * current keyspace, then contentsCron() swaps the new generation in. */
+void reloadContents(void) {
+    if (contentsCompiling) {
+        contentsReloadPending = 1;
+        return;
+    }
+
+    contentsCompiling = 1;
+    contentsReloadPending = 0;
+    bioCreateBackgroundJob(BIO_COMPILE_CONTENTS, createContentGeneration(server.content_dir, server.public_dir), NULL, NULL);
+}
+
+/* Called by the bio thread. server.contents belongs to the job in flight,
+ * the main thread only touches it through applyContentGeneration(). */
+void compileContentsJob(void *arg) {
+    contentGeneration *gen = arg;
+
+    if (compileContents(gen) == C_ERR) {
+        freeContentGeneration(gen);
+        gen = NULL;
+    }
+
+    pthread_mutex_lock(&contentsLock);
+    contentsCompiled = gen;
+    contentsDone = 1;
+    pthread_mutex_unlock(&contentsLock);
+}
+
+/* ============================ Watch contents  ======================== */
+#ifdef __linux__
+#define CONTENTS_WATCH_MASK (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                             IN_ATTRIB | IN_ONLYDIR)
+
+/* A watched directory, at index 'wd' of contentsWatches */
+typedef struct contentWatch {
+    sds path;      /* NULL for a free slot */
+    int isPublic;  /* Under public dir, its files may be cached */
+    int depth;
+} contentWatch;
+
+static int contentsWatchFd = -1;
+static contentWatch *contentsWatches;
+static int contentsWatchesSize;
+#endif
+
+static long long contentsReloadAt; /* Debounced reload, 0 if none */
+
+#ifdef __linux__
+/* Watch 'path' and the directories below it */
+static void addContentsWatch(sds path, int isPublic, int depth) {
+    tinydir_dir tdir;
+    int wd;
+
+    if (depth > HTTP_STATIC_MAX_DEPTH) return;
+
+    if ((wd = inotify_add_watch(contentsWatchFd, path, CONTENTS_WATCH_MASK)) == -1) {
+        serverLog(LL_WARNING, "Can't watch '%s': %s", path, strerror(errno));
+        return;
+    }
+
+    if (wd >= contentsWatchesSize) {
+        int size = wd * 2 + 16;
+
+        contentsWatches = zrealloc(contentsWatches, sizeof(contentWatch) * size);
+        memset(contentsWatches + contentsWatchesSize, 0, sizeof(contentWatch) * (size - contentsWatchesSize));
+        contentsWatchesSize = size;
+    }
+
+    // Watching the same directory twice returns its existing descriptor
+    sdsfree(contentsWatches[wd].path);
+    contentsWatches[wd].path = sdsdup(path);
+    contentsWatches[wd].isPublic = isPublic;
+    contentsWatches[wd].depth = depth;
+
+    if (tinydir_open(&tdir, path) == -1) return;
+
+    for (; tdir.has_next; tinydir_next(&tdir)) {
+        tinydir_file file;
+
+        if (tinydir_readfile(&tdir, &file) == -1) continue;
+        if (file.name[0] == '.' || !file.is_dir) continue;
+
+        sds child = sdscat(sdscat(sdsdup(path), "/"), file.name);
+        addContentsWatch(child, isPublic, depth + 1);
+        sdsfree(child);
+    }
+
+    tinydir_close(&tdir);
+}
+
+/* Stop watching the directories at or below 'path', moved elsewhere */
+static void removeContentsWatches(sds path) {
+    size_t len = sdslen(path);
+    int wd;
+
+    for (wd = 0; wd < contentsWatchesSize; wd++) {
+        sds watched = contentsWatches[wd].path;
+
+        if (watched && !strncmp(watched, path, len) && (watched[len] == '\0' || watched[len] == '/')) {
+            inotify_rm_watch(contentsWatchFd, wd);
+        }
+    }
+}
+
+/* One inotify event. Any change reschedules the reload, so a burst of
+ * writes (an editor saving, a theme being copied) costs a single one.
+ * A changed public file leaves the caches right away. */
+static void handleContentsWatchEvent(struct inotify_event *ev) {
+    contentWatch *watch;
+
+    contentsReloadAt = mstime() + server.content_watch_delay;
+
+    if (ev->mask & IN_Q_OVERFLOW) {
+        emptyStaticFiles();
+        return;
+    }
+
+    if (ev->wd < 0 || ev->wd >= contentsWatchesSize) return;
+
+    watch = contentsWatches + ev->wd;
+    if (!watch->path) return;
+
+    if (ev->mask & IN_IGNORED) {
+        sdsfree(watch->path);
+        watch->path = NULL;
+        return;
+    }
+
+    if (ev->len == 0 || ev->name[0] == '.') return;
+
+    sds path = sdscat(sdscat(sdsdup(watch->path), "/"), ev->name);
+
+    if (ev->mask & IN_ISDIR) {
+        if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+            addContentsWatch(path, watch->isPublic, watch->depth + 1);
+        } else if (ev->mask & IN_MOVED_FROM) {
+            removeContentsWatches(path);
+        }
+
+        // Its files may be cached under their old paths
+        if (watch->isPublic) emptyStaticFiles();
+    } else if (watch->isPublic) {
+        forgetStaticFile(path);
+    }
+
+    sdsfree(path);
+}
+
+static void contentsWatchHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+
+    UNUSED(el);
+    UNUSED(privdata);
+    UNUSED(mask);
+
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        char *p = buf;
+
+        while (p < buf + n) {
+            struct inotify_event *ev = (struct inotify_event*) p;
+
+            handleContentsWatchEvent(ev);
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+}
+#endif
+
+/* Watch content dir and public dir from the event loop, see contentsCron() */
+void initContentsWatch(void) {
+    if (!server.content_watch) return;
+
+#ifdef __linux__
+    sds contentDir = sdsnew(server.content_dir), publicDir = sdsnew(server.public_dir);
+
+    if ((contentsWatchFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1 ||
+        aeCreateFileEvent(server.el, contentsWatchFd, AE_READABLE, contentsWatchHandler, NULL) == AE_ERR)
+    {
+        serverLog(LL_WARNING, "Can't watch the contents: %s", strerror(errno));
+    } else {
+        addContentsWatch(contentDir, 0, 0);
+        addContentsWatch(publicDir, 1, 0);
+    }
+
+    sdsfree(contentDir);
+    sdsfree(publicDir);
+#else
+    serverLog(LL_WARNING, "content-watch needs inotify, use reload-content-query to reload the contents");
+#endif
+}
+
+/* Called by serverCron(): start a reload once the watched dirs are quiet,
+ * apply a finished reload, start a pending one */
+void contentsCron(void) {
+    contentGeneration *gen;
+    int done;
+
+    if (__sync_bool_compare_and_swap(&contentsReloadAsked, 1, 0)) {
+        reloadContents();
+        emptyStaticFiles();
+    }
+
+    if (contentsReloadAt && mstime() >= contentsReloadAt) {
+        contentsReloadAt = 0;
+        reloadContents();
+    }
+
+    if (!contentsCompiling) return;
+
+    pthread_mutex_lock(&contentsLock);
+    gen = contentsCompiled;
+    done = contentsDone;
+    contentsCompiled = NULL;
+    contentsDone = 0;
+    pthread_mutex_unlock(&contentsLock);
+
+    if (!done) return;
+
+    contentsCompiling = 0;
+    if (gen) applyContentGeneration(gen);
+    if (contentsReloadPending) reloadContents();
+}
+
+
+/* ============================ Access log  ======================== */
+/* Lines are appended to the active buffer of each event loop while its
+ * other one is written by a bio thread, with one write(2) per buffer.
+ * Nothing waits on the disk: when the thread is behind and the active
+ * buffer is full, lines are dropped and counted. */
+static int accessLogFd = -1;              /* Only used by the bio thread */
+static pthread_mutex_t accessLogLock = PTHREAD_MUTEX_INITIALIZER;
+static long long accessLogLost;           /* Lines write(2) failed on, under accessLogLock */
+
+/* Open the log, the buffers of each loop are allocated by initHttpLoop() */
+void initAccessLog(void) {
+    if (!server.access_log[0]) return;
+
+    accessLogFd = open(server.access_log, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+
+    if (accessLogFd == -1) {
+        serverLog(LL_WARNING, "Can't open the access log %s: %s", server.access_log, strerror(errno));
+    }
+}
+
+/* Hand the active buffer of 'loop' to the bio thread and switch to the
+ * other one, unless the other one is still being written */
+static void flushAccessLog(httpLoop *loop) {
+    accessLogBuffer *other;
+    int writing;
+
+    if (!loop->accessLogActive || loop->accessLogActive->len == 0) return;
+
+    other = loop->accessLogActive == loop->accessLog ? loop->accessLog + 1 : loop->accessLog;
+
+    pthread_mutex_lock(&accessLogLock);
+    writing = other->writing;
+    if (!writing) loop->accessLogActive->writing = 1;
+    pthread_mutex_unlock(&accessLogLock);
+
+    if (writing) return;
+
+    bioCreateBackgroundJob(BIO_ACCESS_LOG, loop->accessLogActive, NULL, NULL);
+
+    loop->accessLogActive = other;
+    loop->accessLogActive->len = 0;
+}
+
+/* Called by the bio thread. The file is opened again once it was moved or
+ * deleted, logrotate needs no signal. */
+void writeAccessLogJob(void *arg) {
+    accessLogBuffer *b = arg;
+    struct stat st, fst;
+    size_t written = 0;
+
+    if (stat(server.access_log, &st) == -1 ||
+        (fstat(accessLogFd, &fst) == 0 && (st.st_ino != fst.st_ino || st.st_dev != fst.st_dev)))
+    {
+        int fd = open(server.access_log, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+
+        if (fd != -1) {
+            close(accessLogFd);
+            accessLogFd = fd;
+        }
+    }
+
+    while (written < b->len) {
+        ssize_t nwritten = write(accessLogFd, b->buf + written, b->len - written);
+
+        if (nwritten == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        written += nwritten;
+    }
+
+    if (written < b->len) {
+        long long lost = 0;
+        const char *p = b->buf + written, *end = b->buf + b->len;
+
+        while ((p = memchr(p, '\n', end - p)) != NULL) {
+            lost++;
+            p++;
+        }
+
+        pthread_mutex_lock(&accessLogLock);
+        accessLogLost += lost;
+        pthread_mutex_unlock(&accessLogLock);
+    }
+
+    pthread_mutex_lock(&accessLogLock);
+    b->writing = 0;
+    pthread_mutex_unlock(&accessLogLock);
+}
+
+static int isAccessLogWriting(void) {
+    int i, writing = 0;
+
+    pthread_mutex_lock(&accessLogLock);
+    for (i = 0; i < httpNumLoops; i++) {
+        writing |= httpLoops[i].accessLog[0].writing | httpLoops[i].accessLog[1].writing;
+    }
+    pthread_mutex_unlock(&accessLogLock);
+
+    return writing;
+}
+
+/* On shutdown, once the workers are stopped, write what is left from the
+ * main thread */
+void closeAccessLog(void) {
+    int i;
+
+    if (accessLogFd == -1) return;
+
+    while (isAccessLogWriting()) usleep(1000);
+
+    for (i = 0; i < httpNumLoops; i++) {
+        httpLoop *loop = httpLoops + i;
+
+        if (!loop->accessLogActive) continue;
+
+        writeAccessLogJob(loop->accessLogActive);
+        loop->accessLogActive->len = 0;
+    }
+}
+
+static int catAccessLog(char **p, char *end, const char *s, size_t len) {
+    if ((size_t) (end - *p) < len) return C_ERR;
+
+    memcpy(*p, s, len);
+    *p += len;
+    return C_OK;
+}
+
+/* Quotes, backslashes and control bytes are escaped, \xHH or JSON escapes,
+ * so that a request can't forge a line */
+static int catAccessLogEscaped(char **p, char *end, const char *s, size_t len, int json) {
+    static const char hex[] = "0123456789abcdef";
+    char *dst = *p;
+    size_t i;
+
+    if (len > HTTP_ACCESS_LOG_MAX_FIELD) len = HTTP_ACCESS_LOG_MAX_FIELD;
+
+    for (i = 0; i < len; i++) {
+        unsigned char ch = s[i];
+
+        if (end - dst < 6) return C_ERR;
+
+        if (json && (ch == '"' || ch == '\\')) {
+            *dst++ = '\\';
+            *dst++ = ch;
+        } else if (ch < 0x20 || ch == 0x7f || (!json && (ch == '"' || ch == '\\' || ch > 0x7f))) {
+            *dst++ = '\\';
+            if (json) {
+                memcpy(dst, "u00", 3);
+                dst += 3;
+            } else {
+                *dst++ = 'x';
+            }
+            *dst++ = hex[ch >> 4];
+            *dst++ = hex[ch & 0xf];
+        } else {
+            *dst++ = ch;
+        }
+    }
+
+    *p = dst;
+    return C_OK;
+}
+
+static int catAccessLogNumber(char **p, char *end, long long value) {
+    char buf[LONG_STR_SIZE];
+
+    return catAccessLog(p, end, buf, ll2string(buf, sizeof(buf), value));
+}
+
+/* A header value in quotes, "-" or null if the request has none */
+static int catAccessLogHeader(char **p, char *end, const char *value, size_t len, int json) {
+    if (!value) return json ? catAccessLog(p, end, "null", 4) : catAccessLog(p, end, "\"-\"", 3);
+
+    if (catAccessLog(p, end, "\"", 1) == C_ERR ||
+        catAccessLogEscaped(p, end, value, len, json) == C_ERR) return C_ERR;
+
+    return catAccessLog(p, end, "\"", 1);
+}
+
+/* The time of the lines, formatted once per second */
+static void updateAccessLogTime(httpLoop *loop) {
+    struct tm tm;
+
+    if (loop->accessLogTimeAt == server.unixtime) return;
+
+    loop->accessLogTimeAt = server.unixtime;
+    gmtime_r(&loop->accessLogTimeAt, &tm);
+    loop->accessLogTimeLen = strftime(loop->accessLogTime, sizeof(loop->accessLogTime),
+        server.access_log_format == HTTP_ACCESS_LOG_JSON ? "%Y-%m-%dT%H:%M:%SZ" : "%d/%b/%Y:%H:%M:%S +0000", &tm);
+}
+
+/* Append the line of the request just answered on 'c', whose header block
+ * is the 'length' bytes at 'request'. It is built in place and only kept if
+ * it fits. */
+static void logHttpAccess(httpConn *c, const char *request, size_t length, const char *route, long long usec) {
+    httpLoop *loop = c->loop;
+    int json = server.access_log_format == HTTP_ACCESS_LOG_JSON;
+    char *start, *p, *end;
+    const char *peer, *port, *line;
+    size_t before = loop->accessLogActive->len;
+    int err = 0;
+
+    if (++loop->accessLogSkipped < server.access_log_sample) return;
+    loop->accessLogSkipped = 0;
+
+    updateAccessLogTime(loop);
+
+    start = p = loop->accessLogActive->buf + before;
+    end = loop->accessLogActive->buf + loop->accessLogSize;
+
+    // "ip:port", or "[ip]:port" for IPv6
+    peer = getHttpConnPeerId(c);
+    port = strrchr(peer, ':');
+
+    // The request line, up to its CRLF
+    line = memchr(request, '\n', length);
+    length = line ? (size_t) (line - request) : length;
+    if (length > 0 && request[length - 1] == '\r') length--;
+
+    if (json) {
+        err |= catAccessLog(&p, end, "{\"time\":\"", 9);
+        err |= catAccessLog(&p, end, loop->accessLogTime, loop->accessLogTimeLen);
+        err |= catAccessLog(&p, end, "\",\"remote\":\"", 12);
+        err |= catAccessLogEscaped(&p, end, peer, port ? (size_t) (port - peer) : strlen(peer), json);
+        err |= catAccessLog(&p, end, "\",\"request\":", 12);
+        err |= catAccessLogHeader(&p, end, request, length, json);
+        err |= catAccessLog(&p, end, ",\"status\":", 10);
+        err |= catAccessLogNumber(&p, end, c->status);
+        err |= catAccessLog(&p, end, ",\"bytes\":", 9);
+        err |= catAccessLogNumber(&p, end, c->sent);
+        err |= catAccessLog(&p, end, ",\"referer\":", 11);
+        err |= catAccessLogHeader(&p, end, c->referer, c->refererlen, json);
+        err |= catAccessLog(&p, end, ",\"agent\":", 9);
+        err |= catAccessLogHeader(&p, end, c->agent, c->agentlen, json);
+        err |= catAccessLog(&p, end, ",\"route\":\"", 10);
+        err |= catAccessLog(&p, end, route, strlen(route));
+        err |= catAccessLog(&p, end, "\",\"usec\":", 9);
+        err |= catAccessLogNumber(&p, end, usec);
+        err |= catAccessLog(&p, end, "}\n", 2);
+    } else {
+        err |= catAccessLogEscaped(&p, end, peer, port ? (size_t) (port - peer) : strlen(peer), json);
+        err |= catAccessLog(&p, end, " - - [", 6);
+        err |= catAccessLog(&p, end, loop->accessLogTime, loop->accessLogTimeLen);
+        err |= catAccessLog(&p, end, "] ", 2);
+        err |= catAccessLogHeader(&p, end, request, length, json);
+        err |= catAccessLog(&p, end, " ", 1);
+        err |= catAccessLogNumber(&p, end, c->status);
+        err |= catAccessLog(&p, end, " ", 1);
+        err |= catAccessLogNumber(&p, end, c->sent);
+
+        if (server.access_log_format == HTTP_ACCESS_LOG_COMBINED) {
+            err |= catAccessLog(&p, end, " ", 1);
+            err |= catAccessLogHeader(&p, end, c->referer, c->refererlen, json);
+            err |= catAccessLog(&p, end, " ", 1);
+            err |= catAccessLogHeader(&p, end, c->agent, c->agentlen, json);
+        }
+
+        err |= catAccessLog(&p, end, "\n", 1);
+    }
+
+    if (err) {
+        loop->accessLogDropped++;
+        return;
+    }
+
+    loop->accessLogActive->len += p - start;
+    loop->accessLogLines++;
+
+    // Don't wait for the cron when requests come fast
+    if (before < loop->accessLogSize / 2 && loop->accessLogActive->len >= loop->accessLogSize / 2) {
+        flushAccessLog(loop);
+    }
+}
+
+/* ============================ Http metrics  ======================== */
+/* Counted around each request by processHttpInputBuffer(): a few additions
+ * and two clock reads, cheap enough to be always on. Each loop counts its
+ * own requests, INFO and the metrics add them up. */
+static const int httpStatusCodes[] = {200, 206, 304, 400, 404, 416, 431, 500};
+#define HTTP_NUM_STATUS_CODES (sizeof(httpStatusCodes) / sizeof(int))
+
+/* Histogram buckets exported to Prometheus: 2^4 to 2^24 usec, boundaries
+ * every latency bucket shares */
+#define HTTP_METRICS_MIN_BUCKET 4
+#define HTTP_METRICS_MAX_BUCKET 24
+
+void resetHttpStats(void) {
+    int i;
+
+    for (i = 0; i < httpNumLoops; i++) {
+        memset(httpLoops[i].routeStats, 0, sizeof(httpStats) * (HTTP_NUM_ROUTES + 2));
+        memset(httpLoops[i].statusStats, 0, sizeof(httpStats) * (HTTP_NUM_STATUS_CODES + 1));
+        httpLoops[i].responseCacheHits = 0;
+        httpLoops[i].responseCacheMisses = 0;
+    }
+}
+
+/* Sum 'count' stats of each loop into 'dst', the ones at 'offset' bytes in
+ * httpLoop. Counters of the workers are read while they change: a total may
+ * miss the requests being answered. */
+static void mergeHttpStats(httpStats *dst, size_t offset, unsigned int count) {
+    unsigned int i, k;
+    int l;
+
+    memset(dst, 0, sizeof(httpStats) * count);
+
+    for (l = 0; l < httpNumLoops; l++) {
+        httpStats *src = *(httpStats**) ((char*) (httpLoops + l) + offset);
+
+        for (i = 0; i < count; i++) {
+            dst[i].requests += src[i].requests;
+            dst[i].sent += src[i].sent;
+            dst[i].usec += src[i].usec;
+            if (src[i].maxUsec > dst[i].maxUsec) dst[i].maxUsec = src[i].maxUsec;
+            for (k = 0; k < HTTP_LATENCY_BUCKETS; k++) dst[i].latency[k] += src[i].latency[k];
+        }
+    }
+}
+
+/* The access log counters of every loop */
+static void getAccessLogCounts(long long *lines, long long *dropped, long long *lost) {
+    int i;
+
+    *lines = *dropped = 0;
+    for (i = 0; i < httpNumLoops; i++) {
+        *lines += httpLoops[i].accessLogLines;
+        *dropped += httpLoops[i].accessLogDropped;
+    }
+
+    pthread_mutex_lock(&accessLogLock);
+    *lost = accessLogLost;
+    pthread_mutex_unlock(&accessLogLock);
+}
+
+static const char *getHttpRouteName(unsigned int route) {
+    if (route < HTTP_NUM_ROUTES) return httpRoutes[route].name;
+    return route == HTTP_ROUTE_METRICS ? "metrics" : "none";
+}
+
+static void getHttpStatusName(unsigned int status, char *buf, size_t len) {
+    if (status < HTTP_NUM_STATUS_CODES) {
+        ll2string(buf, len, httpStatusCodes[status]);
+    } else {
+        snprintf(buf, len, "other");
+    }
+}
+
+/* Index of the latency bucket of 'usec'. Values are shifted by one so each
+ * bucket holds (lower, upper], like a Prometheus "le" bucket. */
+static int httpLatencyBucket(long long usec) {
+    unsigned long long v = usec > 0 ? (unsigned long long) usec - 1 : 0;
+    int msb;
+
+    if (v < HTTP_LATENCY_SUB_BUCKETS) return (int) v;
+    if (v > UINT32_MAX) v = UINT32_MAX;
+
+    msb = 63 - __builtin_clzll(v);
+    return (msb - HTTP_LATENCY_SUB_BITS + 1) * HTTP_LATENCY_SUB_BUCKETS +
+        (int) ((v >> (msb - HTTP_LATENCY_SUB_BITS)) & (HTTP_LATENCY_SUB_BUCKETS - 1));
+}
+
+/* The largest latency counted in 'bucket' */
+static long long httpLatencyBucketMax(int bucket) {
+    int next = bucket + 1, msb;
+
+    if (next < HTTP_LATENCY_SUB_BUCKETS) return next;
+
+    msb = next / HTTP_LATENCY_SUB_BUCKETS - 1 + HTTP_LATENCY_SUB_BITS;
+    return (long long) (HTTP_LATENCY_SUB_BUCKETS + next % HTTP_LATENCY_SUB_BUCKETS) <<
+        (msb - HTTP_LATENCY_SUB_BITS);
+}
+
+static long long getHttpLatencyPercentile(httpStats *st, double percentile) {
+    long long target = (long long) (percentile * st->requests), seen = 0;
+    int i;
+
+    if (target < percentile * st->requests) target++;
+    if (target < 1) target = 1;
+
+    for (i = 0; i < HTTP_LATENCY_BUCKETS; i++) {
+        seen += st->latency[i];
+
+        if (seen >= target) {
+            long long max = httpLatencyBucketMax(i);
+            return max < st->maxUsec ? max : st->maxUsec;
+        }
+    }
+
+    return st->maxUsec;
+}
+
+static void updateHttpStats(httpStats *st, int bucket, long long usec, size_t sent) {
+    st->requests++;
+    st->sent += sent;
+    st->usec += usec;
+    if (usec > st->maxUsec) st->maxUsec = usec;
+    st->latency[bucket]++;
+}
+
+/* Account the request just answered in its route and its status code, and
+ * log it. 'request' holds its 'length' bytes of header. */
+static void recordHttpRequest(httpConn *c, const char *request, size_t length, long long usec) {
+    httpLoop *loop = c->loop;
+    unsigned int route = c->route >= 0 ? (unsigned int) c->route : HTTP_ROUTE_NONE;
+    unsigned int status;
+    int bucket = httpLatencyBucket(usec);
+
+    for (status = 0; status < HTTP_NUM_STATUS_CODES; status++) {
+        if (httpStatusCodes[status] == c->status) break;
+    }
+
+    updateHttpStats(loop->routeStats + route, bucket, usec, c->sent);
+    updateHttpStats(loop->statusStats + status, bucket, usec, c->sent);
+
+    if (loop->accessLogActive) logHttpAccess(c, request, length, getHttpRouteName(route), usec);
+
+    c->route = -1;
+    c->status = 0;
+    c->sent = 0;
+    c->referer = NULL;
+    c->agent = NULL;
+}
+
+/* Count a part of the response being queued, the first one starts with
+ * the status line */
+static void countHttpReply(httpConn *c, const char *reply, size_t len) {
+    if (!c->status && reply && len > 12 && !memcmp(reply, "HTTP/1.1 ", 9)) {
+        c->status = (reply[9] - '0') * 100 + (reply[10] - '0') * 10 + (reply[11] - '0');
+    }
+
+    c->sent += len;
+}
+
+/* Queue 'length' bytes of 'o' from 'offset', 'borrowed' if it lives in the
+ * snapshot of the loop. Nothing is copied. */
+static void addHttpReplySlice(httpConn *c, robj *o, int borrowed, size_t offset, size_t length) {
+    countHttpReply(c, (char*) o->ptr + offset, length);
+    addHttpConnReply(c, o, NULL, offset, length, borrowed);
+}
+
+static void addHttpReplyObject(httpConn *c, robj *o, int borrowed) {
+    addHttpReplySlice(c, o, borrowed, 0, sdslen(o->ptr));
+}
+
+/* Queue a byte range of a static file, sent with sendfile(2) */
+static void addHttpReplyFile(httpConn *c, staticFile *file, off_t offset, size_t length) {
+    countHttpReply(c, NULL, length);
+    addHttpConnReply(c, NULL, file, offset, length, 0);
+}
+
+static sds catHttpStatsInfo(sds info, const char *kind, const char *name, httpStats *st) {
+    return sdscatprintf(info,
+        "http_%s_%s:requests=%lld,sent_bytes=%lld,usec=%lld,usec_per_request=%.2f,"
+        "p50=%lld,p99=%lld,p999=%lld,max=%lld\r\n",
+        kind, name, st->requests, st->sent, st->usec, (double) st->usec / st->requests,
+        getHttpLatencyPercentile(st, 0.5), getHttpLatencyPercentile(st, 0.99),
+        getHttpLatencyPercentile(st, 0.999), st->maxUsec);
+}
+
+/* The "# Http" section of INFO, latencies are in microseconds */
+sds genHttpInfoString(sds info) {
+    httpStats routeStats[HTTP_NUM_ROUTES + 2], statusStats[HTTP_NUM_STATUS_CODES + 1];
+    long long requests = 0, sent = 0, lines, dropped, lost, cacheHits, cacheMisses;
+    unsigned long cacheEntries;
+    char name[LONG_STR_SIZE];
+    unsigned int i;
+
+    mergeHttpStats(routeStats, offsetof(httpLoop, routeStats), HTTP_NUM_ROUTES + 2);
+    mergeHttpStats(statusStats, offsetof(httpLoop, statusStats), HTTP_NUM_STATUS_CODES + 1);
+    getAccessLogCounts(&lines, &dropped, &lost);
+    getResponseCacheCounts(&cacheEntries, &cacheHits, &cacheMisses);
+
+    for (i = 0; i < HTTP_NUM_ROUTES + 2; i++) {
+        requests += routeStats[i].requests;
+        sent += routeStats[i].sent;
+    }
+
+    info = sdscatprintf(info,
+        "# Http\r\n"
+        "http_workers:%d\r\n"
+        "http_connections:%lld\r\n"
+        "http_requests:%lld\r\n"
+        "http_sent_bytes:%lld\r\n"
+        "access_log_lines:%lld\r\n"
+        "access_log_dropped:%lld\r\n"
+        "access_log_lost:%lld\r\n"
+        "response_cache_entries:%lu\r\n"
+        "response_cache_hits:%lld\r\n"
+        "response_cache_misses:%lld\r\n",
+        server.http_workers, __atomic_load_n(&httpConnections, __ATOMIC_RELAXED),
+        requests, sent, lines, dropped, lost, cacheEntries, cacheHits, cacheMisses);
+
+    for (i = 0; i < HTTP_NUM_ROUTES + 2; i++) {
+        if (routeStats[i].requests) {
+            info = catHttpStatsInfo(info, "route", getHttpRouteName(i), routeStats + i);
+        }
+    }
+
+    for (i = 0; i < HTTP_NUM_STATUS_CODES + 1; i++) {
+        if (statusStats[i].requests) {
+            getHttpStatusName(i, name, sizeof(name));
+            info = catHttpStatsInfo(info, "status", name, statusStats + i);
+        }
+    }
+
+    return info;
+}
+
+/* A counter, a byte counter and a latency histogram named after 'family',
+ * one series per entry of 'stats' labelled with 'names' */
+static sds catHttpMetricsFamily(sds out, const char *family, const char *help, const char *label,
+                                const char **names, httpStats *stats, unsigned int count)
+{
+    unsigned int i;
+    int k;
+
+    out = sdscatprintf(out, "# HELP %s_total %s.\n# TYPE %s_total counter\n", family, help, family);
+    for (i = 0; i < count; i++) {
+        out = sdscatprintf(out, "%s_total{%s=\"%s\"} %lld\n", family, label, names[i], stats[i].requests);
+    }
+
+    out = sdscatprintf(out, "# HELP %s_sent_bytes_total Response bytes queued.\n"
+        "# TYPE %s_sent_bytes_total counter\n", family, family);
+    for (i = 0; i < count; i++) {
+        out = sdscatprintf(out, "%s_sent_bytes_total{%s=\"%s\"} %lld\n", family, label, names[i], stats[i].sent);
+    }
+
+    out = sdscatprintf(out, "# HELP %s_duration_seconds Time spent answering on the event loop.\n"
+        "# TYPE %s_duration_seconds histogram\n", family, family);
+    for (i = 0; i < count; i++) {
+        httpStats *st = stats + i;
+        long long seen = 0;
+        int bucket = 0;
+
+        for (k = HTTP_METRICS_MIN_BUCKET; k <= HTTP_METRICS_MAX_BUCKET; k++) {
+            int end = (k - HTTP_LATENCY_SUB_BITS + 1) * HTTP_LATENCY_SUB_BUCKETS;
+
+            for (; bucket < end; bucket++) seen += st->latency[bucket];
+            out = sdscatprintf(out, "%s_duration_seconds_bucket{%s=\"%s\",le=\"%.6f\"} %lld\n",
+                family, label, names[i], (double) (1LL << k) / 1000000, seen);
+        }
+
+        out = sdscatprintf(out,
+            "%s_duration_seconds_bucket{%s=\"%s\",le=\"+Inf\"} %lld\n"
+            "%s_duration_seconds_sum{%s=\"%s\"} %.6f\n"
+            "%s_duration_seconds_count{%s=\"%s\"} %lld\n",
+            family, label, names[i], st->requests,
+            family, label, names[i], (double) st->usec / 1000000,
+            family, label, names[i], st->requests);
+    }
+
+    return out;
+}
+
+/* Answer metrics-path with every route and status code in the Prometheus
+ * text format */
+static void responseHttpMetrics(httpConn *c) {
+    httpStats routeStats[HTTP_NUM_ROUTES + 2], statusStats[HTTP_NUM_STATUS_CODES + 1];
+    const char *routes[HTTP_NUM_ROUTES + 2], *codes[HTTP_NUM_STATUS_CODES + 1];
+    char codeNames[HTTP_NUM_STATUS_CODES + 1][LONG_STR_SIZE];
+    sds body = sdsempty(), reply;
+    long long lines, dropped, lost, cacheHits, cacheMisses;
+    unsigned long cacheEntries;
+    unsigned int i;
+    robj *o;
+
+    mergeHttpStats(routeStats, offsetof(httpLoop, routeStats), HTTP_NUM_ROUTES + 2);
+    mergeHttpStats(statusStats, offsetof(httpLoop, statusStats), HTTP_NUM_STATUS_CODES + 1);
+    getAccessLogCounts(&lines, &dropped, &lost);
+    getResponseCacheCounts(&cacheEntries, &cacheHits, &cacheMisses);
+
+    for (i = 0; i < HTTP_NUM_ROUTES + 2; i++) routes[i] = getHttpRouteName(i);
+
+    for (i = 0; i < HTTP_NUM_STATUS_CODES + 1; i++) {
+        getHttpStatusName(i, codeNames[i], sizeof(codeNames[i]));
+        codes[i] = codeNames[i];
+    }
+
+    body = catHttpMetricsFamily(body, "blogd_http_requests", "Requests answered, by route",
+        "route", routes, routeStats, HTTP_NUM_ROUTES + 2);
+    body = catHttpMetricsFamily(body, "blogd_http_responses", "Responses sent, by status code",
+        "code", codes, statusStats, HTTP_NUM_STATUS_CODES + 1);
+
+    body = sdscatprintf(body,
+        "# HELP blogd_access_log_lines_total Access log lines, by fate.\n"
+        "# TYPE blogd_access_log_lines_total counter\n"
+        "blogd_access_log_lines_total{fate=\"buffered\"} %lld\n"
+        "blogd_access_log_lines_total{fate=\"dropped\"} %lld\n"
+        "blogd_access_log_lines_total{fate=\"lost\"} %lld\n"
+        "# HELP blogd_response_cache_lookups_total Request paths looked up in the response cache, by result.\n"
+        "# TYPE blogd_response_cache_lookups_total counter\n"
+        "blogd_response_cache_lookups_total{result=\"hit\"} %lld\n"
+        "blogd_response_cache_lookups_total{result=\"miss\"} %lld\n"
+        "# HELP blogd_response_cache_entries Request paths in the response cache.\n"
+        "# TYPE blogd_response_cache_entries gauge\n"
+        "blogd_response_cache_entries %lu\n",
+        lines, dropped, lost, cacheHits, cacheMisses, cacheEntries);
+
+    reply = sdscatfmt(sdsempty(),
+        "HTTP/1.1 200 OK\r\n"
+        "Server: Blogd\r\n"
+        "Cache-Control: " HTTP_CACHE_NONE "\r\n"
+        "Content-length: %U\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n\r\n",
+        (unsigned long long) sdslen(body));
+
+    if (c->method == HTTP_METHOD_GET) reply = sdscatsds(reply, body);
+    sdsfree(body);
+
+    o = createObject(OBJ_STRING, reply);
+    addHttpReplyObject(c, o, 0);
+    decrRefCount(o);
+}
+
+/* ============================ Conditional requests  ======================== */
+/* The value of the header 'name' (as "\r\nName: ") in a pre-serialized
+ * response, NULL if it has none. Only the header block is searched. */
+static const char *findHttpHeader(const char *response, size_t len, const char *name, size_t *valueLen) {
+    const char *end = memmem(response, len, "\r\n\r\n", 4), *value, *eol;
+    size_t nameLen = strlen(name);
+
+    if (!end) return NULL;
+    if ((value = memmem(response, end + 2 - response, name, nameLen)) == NULL) return NULL;
+
+    value += nameLen;
+    eol = memchr(value, '\r', end + 2 - value);
+    *valueLen = eol - value;
+    return value;
+}
+
+/* An IMF-fixdate ("Sun, 06 Nov 1994 08:49:37 GMT"), the only format we
+ * send. Returns -1 if it can't be parsed. */
+static time_t parseHttpDate(const char *value, size_t len) {
+    char date[64], *end;
+    struct tm tm;
+
+    if (len >= sizeof(date)) return -1;
+
+    memcpy(date, value, len);
+    date[len] = '\0';
+    memset(&tm, 0, sizeof(tm));
+
+    end = strptime(date, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (!end || *end != '\0') return -1;
+
+    return timegm(&tm);
+}
+
+/* Whether an entry of the If-None-Match list 'etags' is the ETag 'etag'.
+ * The comparison is weak, as RFC 7232 asks for GET and HEAD. */
+static int isHttpETagListed(const char *etags, size_t len, const char *etag, size_t etagLen) {
+    const char *p = etags, *end = etags + len;
+
+    while (p < end) {
+        const char *next = memchr(p, ',', end - p), *tagEnd;
+
+        if (!next) next = end;
+
+        for (; p < next && (*p == ' ' || *p == '\t'); p++);
+        for (tagEnd = next; tagEnd > p && (tagEnd[-1] == ' ' || tagEnd[-1] == '\t'); tagEnd--);
+
+        if (tagEnd - p == 1 && *p == '*') return 1;
+        if (tagEnd - p > 2 && p[0] == 'W' && p[1] == '/') p += 2;
+        if ((size_t) (tagEnd - p) == etagLen && !memcmp(p, etag, etagLen)) return 1;
+
+        p = next + 1;
+    }
+
+    return 0;
+}
+
+/* Whether the conditional request matches the validators of 'response',
+ * a successful one. If-None-Match takes precedence over If-Modified-Since. */
+static int isHttpNotModified(httpConn *c, const char *response, size_t len) {
+    const char *value;
+    size_t valueLen;
+
+    if (!c->etags && c->since == -1) return 0;
+    if (len < 12 || memcmp(response + 9, "200", 3)) return 0;
+
+    if (c->etags) {
+        value = findHttpHeader(response, len, "\r\nETag: ", &valueLen);
+
+        return value && isHttpETagListed(c->etags, c->etagslen, value, valueLen);
+    }
+
+    value = findHttpHeader(response, len, "\r\nLast-Modified: ", &valueLen);
+
+    if (!value) return 0;
+
+    time_t lastModified = parseHttpDate(value, valueLen);
+
+    return lastModified != -1 && lastModified <= c->since;
+}
+
+/* Answer with the headers of the response 'o' under a 304 status, without
+ * its body: everything before Content-length, which buildHttpHeaders() puts
+ * last with Content-Type. They are sent from 'o' itself. */
+static void responseHttpNotModified(httpConn *c, robj *o, int borrowed) {
+    const char *response = o->ptr;
+    size_t len = sdslen(o->ptr);
+    const char *fields = (const char*) memchr(response, '\n', len) + 1;
+    const char *bodyFields = memmem(response, len, "\r\nContent-length: ", 18);
+
+    if (!bodyFields) bodyFields = memmem(response, len, "\r\n\r\n", 4);
+    bodyFields += 2;
+
+    addHttpReplyObject(c, c->loop->notModified, 0);
+    addHttpReplySlice(c, o, borrowed, fields - response, bodyFields - fields);
+    addHttpReplyObject(c, c->loop->crlf, 0);
+}
+
+/* ============================ Range requests  ======================== */
+/* Whether the If-Range of the request, if any, still names the file whose
+ * 'headers' are given: an ETag has to match strongly, a date exactly. */
+static int isHttpRangeFresh(httpConn *c, const char *headers) {
+    const char *value;
+    size_t valueLen, len = sdslen((sds) headers);
+
+    if (!c->ifrange) return 1;
+
+    if (c->ifrange[0] == '"' || c->ifrange[0] == 'W') {
+        value = findHttpHeader(headers, len, "\r\nETag: ", &valueLen);
+
+        return value && valueLen == c->ifrangelen && !memcmp(value, c->ifrange, valueLen);
+    }
+
+    value = findHttpHeader(headers, len, "\r\nLast-Modified: ", &valueLen);
+
+    return value && parseHttpDate(value, valueLen) == parseHttpDate(c->ifrange, c->ifrangelen);
+}
+
+/* Parse a "bytes=0-99,200-,-50" Range against a file of 'size' bytes into
+ * 'ranges', at most HTTP_MAX_RANGES of them. Returns the number of
+ * satisfiable parts, 0 if there is none (a 416), or -1 if the header has
+ * to be ignored: invalid, another unit, or too many parts. */
+static int parseHttpRanges(const char *value, size_t len, off_t size, httpRange *ranges) {
+    const char *p = value + 6, *end = value + len;
+    int numRanges = 0;
+
+    if (len < 7 || strncasecmp(value, "bytes=", 6)) return -1;
+
+    while (p < end) {
+        const char *next = memchr(p, ',', end - p), *dash;
+        long long start = -1, last = -1;
+
+        if (!next) next = end;
+
+        for (; p < next && (*p == ' ' || *p == '\t'); p++);
+        for (; next > p && (next[-1] == ' ' || next[-1] == '\t'); next--);
+
+        if ((dash = memchr(p, '-', next - p)) == NULL) return -1;
+        if (dash > p && (!string2ll(p, dash - p, &start) || start < 0)) return -1;
+        if (dash + 1 < next && (!string2ll(dash + 1, next - dash - 1, &last) || last < 0)) return -1;
+        if (start == -1 && last == -1) return -1;
+        if (start != -1 && last != -1 && last < start) return -1;
+
+        if (start == -1) {
+            // The last 'last' bytes
+            if (last > 0 && size > 0) {
+                if (numRanges == HTTP_MAX_RANGES) return -1;
+                ranges[numRanges].start = last < size ? size - last : 0;
+                ranges[numRanges++].end = size - 1;
+            }
+        } else if (start < size) {
+            if (numRanges == HTTP_MAX_RANGES) return -1;
+            ranges[numRanges].start = start;
+            ranges[numRanges++].end = (last == -1 || last >= size) ? size - 1 : last;
+        }
+
+        p = memchr(p, ',', end - p);
+        p = p ? p + 1 : end;
+    }
+
+    return numRanges;
+}
+
+/* Answer a Range request on a static file: a 416 when no part can be
+ * served, a 206 with the part, or a multipart/byteranges 206 with each of
+ * them. The headers of the 200 are reused up to Content-length, the bodies
+ * are file slices sent with sendfile(2) like a whole file. */
+static void responseHttpFileRanges(httpConn *c, staticFile *file, httpRange *ranges, int numRanges) {
+    const char *headers = file->headers->ptr;
+    size_t len = sdslen((sds) headers), typeLen;
+    const char *fields = (const char*) memchr(headers, '\n', len) + 1;
+    const char *bodyFields = (const char*) memmem(headers, len, "\r\nContent-length: ", 18) + 2;
+    const char *type = findHttpHeader(headers, len, "\r\nContent-Type: ", &typeLen);
+    robj *o;
+    sds reply;
+    int i;
+
+    if (numRanges == 0) {
+        reply = sdscatfmt(sdsempty(),
+            "HTTP/1.1 416 Range Not Satisfiable\r\n"
+            "Server: Blogd\r\n"
+            "Cache-Control: " HTTP_CACHE_NONE "\r\n"
+            "Content-Range: bytes */%I\r\n"
+            "Content-length: 0\r\n\r\n",
+            (long long) file->size);
+        o = createObject(OBJ_STRING, reply);
+        addHttpReplyObject(c, o, 0);
+        decrRefCount(o);
+        return;
+    }
+
+    reply = sdscatlen(sdsnew("HTTP/1.1 206 Partial Content\r\n"), fields, bodyFields - fields);
+
+    if (numRanges == 1) {
+        reply = sdscatfmt(reply,
+            "Content-Range: bytes %I-%I/%I\r\n"
+            "Content-length: %I\r\n"
+            "Content-Type: ",
+            (long long) ranges[0].start, (long long) ranges[0].end, (long long) file->size,
+            (long long) (ranges[0].end - ranges[0].start + 1));
+        reply = sdscatlen(reply, type, typeLen);
+        reply = sdscat(reply, "\r\n\r\n");
+
+        o = createObject(OBJ_STRING, reply);
+        addHttpReplyObject(c, o, 0);
+        decrRefCount(o);
+
+        addHttpReplyFile(c, file, ranges[0].start, ranges[0].end - ranges[0].start + 1);
+        return;
+    }
+
+    // Part headers first, the total length has to be known up front
+    sds parts[HTTP_MAX_RANGES];
+    long long length = sizeof("\r\n--" HTTP_RANGES_BOUNDARY "--\r\n") - 1;
+
+    for (i = 0; i < numRanges; i++) {
+        parts[i] = sdscatlen(sdsnew("\r\n--" HTTP_RANGES_BOUNDARY "\r\nContent-Type: "), type, typeLen);
+        parts[i] = sdscatfmt(parts[i], "\r\nContent-Range: bytes %I-%I/%I\r\n\r\n",
+            (long long) ranges[i].start, (long long) ranges[i].end, (long long) file->size);
+        length += sdslen(parts[i]) + ranges[i].end - ranges[i].start + 1;
+    }
+
+    reply = sdscatfmt(reply,
+        "Content-length: %I\r\n"
+        "Content-Type: multipart/byteranges; boundary=" HTTP_RANGES_BOUNDARY "\r\n\r\n",
+        length);
+    reply = sdscatsds(reply, parts[0]);
+    sdsfree(parts[0]);
+    parts[0] = reply;
+
+    for (i = 0; i < numRanges; i++) {
+        o = createObject(OBJ_STRING, parts[i]);
+        addHttpReplyObject(c, o, 0);
+        decrRefCount(o);
+
+        addHttpReplyFile(c, file, ranges[i].start, ranges[i].end - ranges[i].start + 1);
+    }
+
+    o = createObject(OBJ_STRING, sdsnew("\r\n--" HTTP_RANGES_BOUNDARY "--\r\n"));
+    addHttpReplyObject(c, o, 0);
+    decrRefCount(o);
+}
+
+/* ============================ Http response callbacks  ======================== */
+void responseHttpIndex(void *cl, char **matches) {
+    httpConn *c = (httpConn*) cl;
+    robj *response = lookupHttpResponse(c, PAGE_KEY_PREFIX, "1");
+
+    UNUSED(matches);
+
+    if (!response) {
+        responseHttpError(c, 404);
+    } else {
+        responseHttp(c, response);
+    }
+}
+
+void responseHttpPage(void *cl, char **matches) {
+    httpConn *c = (httpConn*) cl;
+    robj *response = lookupHttpResponse(c, PAGE_KEY_PREFIX, matches[0]);
+
+    if (!response) {
+        responseHttpError(c, 404);
+    } else {
+        responseHttp(c, response);
+    }
+}
+
+void responseHttpContent(void *cl, char **matches) {
+    httpConn *c = (httpConn*) cl;
+    robj *response = lookupHttpResponse(c, POST_KEY_PREFIX, matches[0]);
+
+    if (!response) {
+        responseHttpError(c, 404);
+    } else {
+        responseHttp(c, response);
+    }
+}
+
+void responseHttpError(void *cl, int code) {
+    char errorCode[LONG_STR_SIZE];
+
+    ll2string(errorCode, sizeof(errorCode), code);
+
+    httpConn *c = (httpConn*) cl;
+    robj *response = lookupHttpResponse(c, PAGE_ERROR_KEY_PREFIX, errorCode);
+
+    if (!response && c->loop->worker) {
+        // The snapshot is read only: a headers only response, each time
+        sds headers = buildHttpHeaders("html", 0, code, HTTP_ENCODING_NONE, &httpNoCache);
+
+        response = createObject(OBJ_STRING, headers);
+        responseHttpObject(c, response, 0);
+        decrRefCount(response);
+        return;
+    }
+
+    if (!response) {
+        // No template for this code: store a headers only response, once
+        saveHttpResponse(c->loop->lookupKey, "", code);
+        response = lookupHttpResponse(c, PAGE_ERROR_KEY_PREFIX, errorCode);
+    }
+
+    responseHttp(c, response);
+}
+
+void responseHttpFile(void *cl, char **matches) {
+    httpConn *c = (httpConn*) cl;
+    httpLoop *loop = c->loop;
+    size_t baseLen = strlen(matches[0]), extLen = strlen(matches[1]);
+    sds filePath;
+
+    // The gzip variant precompressed by compileStaticDir(), from memory.
+    // A Range is served from the file, by offset.
+    if ((c->accept & HTTP_ACCEPT_GZIP) && !c->range && isHttpCompressible(matches[1])) {
+        char *urlPath = allocHttpRequest(loop, baseLen + extLen + 2);
+        robj *response;
+
+        memcpy(urlPath, matches[0], baseLen);
+        urlPath[baseLen] = '.';
+        memcpy(urlPath + baseLen + 1, matches[1], extLen + 1);
+
+        response = lookupHttpKey(c, GZIP_KEY_PREFIX, STATIC_KEY_PREFIX, urlPath);
+        freeHttpRequest(loop, urlPath);
+
+        if (response) {
+            responseHttp(c, response);
+            return;
+        }
+    }
+
+    filePath = loop->filePath = sdscpy(loop->filePath, server.public_dir);
+    filePath = sdscatlen(filePath, matches[0], baseLen);
+    filePath = sdscatlen(filePath, ".", 1);
+    filePath = loop->filePath = sdscatlen(filePath, matches[1], extLen);
+
+    syncStaticFiles(c->loop);
+
+    // Hot files are answered from memory, no syscall but the socket write
+    if (server.static_memory_cache && !c->range) {
+        robj *response = dictFetchValue(c->loop->staticMemory, filePath);
+
+        if (response) {
+            response->lru = LRU_CLOCK();
+            responseHttpObject(c, response, 0);
+            return;
+        }
+    }
+
+    staticFile *file = lookupStaticFile(c->loop, filePath, matches[1]);
+
+    // Not remembered: a file added to public dir signals no key
+    if (!file) {
+        loop->cacheFilling = 0;
+        responseHttpError(c, 404);
+        return;
+    }
+
+    if (server.static_memory_cache && !c->range) {
+        robj *response = loadStaticMemoryFile(c->loop, filePath, file);
+
+        if (response) {
+            if (file->refcount == 0) releaseStaticFile(file);
+            responseHttpObject(c, response, 0);
+            return;
+        }
+    }
+
+    if (isHttpNotModified(c, file->headers->ptr, sdslen(file->headers->ptr))) {
+        responseHttpNotModified(c, file->headers, 0);
+        if (file->refcount == 0) releaseStaticFile(file);
+        return;
+    }
+
+    if (c->range && c->method == HTTP_METHOD_GET && isHttpRangeFresh(c, file->headers->ptr)) {
+        httpRange ranges[HTTP_MAX_RANGES];
+        int numRanges = parseHttpRanges(c->range, c->rangelen, file->size, ranges);
+
+        if (numRanges >= 0) {
+            responseHttpFileRanges(c, file, ranges, numRanges);
+            if (file->refcount == 0) releaseStaticFile(file);
+            return;
+        }
+    }
+
+    addHttpReplyObject(c, file->headers, 0);
+
+    // The body is streamed by sendfile(2) from the writable handler
+    if (file->size > 0 && c->method == HTTP_METHOD_GET) addHttpReplyFile(c, file, 0, file->size);
+
+    // An uncached file is closed once its last reply is sent
+    if (file->refcount == 0) releaseStaticFile(file);
+}
+
+/* Answer with 'o', 'borrowed' from the snapshot of the loop or holding a
+ * reference of its own */
+static void responseHttpObject(httpConn *c, robj *o, int borrowed) {
+    if (isHttpNotModified(c, o->ptr, sdslen(o->ptr))) {
+        responseHttpNotModified(c, o, borrowed);
+        return;
+    }
+
+    // Only the header block, the body is left in the keyspace
+    if (c->method == HTTP_METHOD_HEAD) {
+        const char *end = memmem(o->ptr, sdslen(o->ptr), "\r\n\r\n", 4);
+
+        if (end) {
+            addHttpReplySlice(c, o, borrowed, 0, end + 4 - (char*) o->ptr);
+            return;
+        }
+    }
+
+    // Pre-serialized response shared with the keyspace, sent without a copy
+    addHttpReplyObject(c, o, borrowed);
+}
+
+/* Answer with a response of the keyspace, or of the snapshot in a worker */
+void responseHttp(void *cl, void *response) {
+    httpConn *c = (httpConn*) cl;
+
+    responseHttpObject(c, (robj*) response, c->loop->worker);
+}
+
+static const char *getHttpMimeType(const char *ext) {
+    httpMime *mime = getHttpMime(ext);
+
+    return mime ? mime->filetype : NULL;
+}
+
+/* Build the status line and headers of a response. This runs once per
+ * compiled page and once per static file, never per request: the result is
+ * stored with the body and shared by every response that sends it.
+ * 'encoding' is one of HTTP_ENCODING_*: both variants of a resource that
+ * has a gzip one carry "Vary: Accept-Encoding" for the caches in between.
+ * The gzip variant is another representation, its ETag gets a suffix.
+ * Content-length and Content-Type come last, see responseHttpNotModified(). */
+sds buildHttpHeaders(const char *contentType, size_t contentLength, int code, int encoding,
+                     const httpCache *cache)
+{
+    const char *mime = getHttpMimeType(contentType);
+    const char *status, *variant;
+    char validators[128];
+    int len = 0;
+
+    if (mime == NULL) {
+        code = 400;
+    }
+
+    switch (code) {
+        case 500:
+            mime = "text/html";
+            status = "500 Internal Server Error";
+            break;
+
+        case 404:
+            mime = "text/html";
+            status = "404 Not Found";
+            break;
+
+        case 400:
+            mime = "text/html";
+            status = "400 Bad Request";
+            break;
+
+        case 431:
+            mime = "text/html";
+            status = "431 Request Header Fields Too Large";
+            break;
+
+        default:
+            status = "200 OK";
+            break;
+    }
+
+    switch (encoding) {
+        case HTTP_ENCODING_GZIP:
+            variant = "Vary: Accept-Encoding\r\nContent-Encoding: gzip\r\n";
+            break;
+
+        case HTTP_ENCODING_IDENTITY:
+            variant = "Vary: Accept-Encoding\r\n";
+            break;
+
+        default:
+            variant = "";
+            break;
+    }
+
+    validators[0] = '\0';
+
+    if (cache->etag) {
+        len += snprintf(validators, sizeof(validators), "ETag: \"%016llx%s\"\r\n",
+            (unsigned long long) cache->etag, encoding == HTTP_ENCODING_GZIP ? "-gz" : "");
+    }
+
+    if (cache->lastModified) {
+        struct tm tm;
+
+        gmtime_r(&cache->lastModified, &tm);
+        len += strftime(validators + len, sizeof(validators) - len,
+            "Last-Modified: %a, %d %b %Y %H:%M:%S GMT\r\n", &tm);
+    }
+
+    if (cache->ranges) {
+        snprintf(validators + len, sizeof(validators) - len, "Accept-Ranges: bytes\r\n");
+    }
+
+    return sdscatfmt(sdsempty(),
+        "HTTP/1.1 %s\r\n"
+        "Server: Blogd\r\n"
+        "Cache-Control: %s\r\n"
+        "%s"
+        "x-content-type-options:nosniff\r\n"
+        "x-frame-options:SAMEORIGIN\r\n"
+        "x-xss-protection:1; mode=block\r\n"
+        "%s"
+        "Content-length: %U\r\n"
+        "Content-Type: %s\r\n\r\n",
+        status, cache->control, validators, variant, (unsigned long long) contentLength, mime);
+}
+
+/* ============================ Process Http Request  ======================== */
+/* HTTP/1.1 connections persist unless the client asks otherwise. HTTP/1.0
+ * ones are closed, the pre-serialized responses can't carry the
+ * "Connection: keep-alive" opt-in it needs. */
+static int isHttpKeepAlive(RequestHeader *header) {
+    unsigned int i;
+
+    if (header->HTTPVersionLen != 8 || strncmp(header->HTTPVersion, "HTTP/1.1", 8)) {
+        return 0;
+    }
+
+    for (i = 0; i < header->HeaderSize; i++) {
+        HeaderField *field = header->Fields + i;
+
+        if (field->FieldNameLen == 10 && !strncasecmp(field->FieldName, "Connection", 10)) {
+            return !(field->ValueLen == 5 && !strncasecmp(field->Value, "close", 5));
+        }
+    }
+
+    return 1;
+}
+
+/* Whether the Accept-Encoding of the request takes gzip. A "gzip" (or
+ * "x-gzip") entry decides, else a "*" one. "q=0" refuses a coding. */
+static int isHttpGzipAccepted(const char *value, size_t len) {
+    const char *p = value, *end = value + len;
+    int gzip = -1, any = -1;
+
+    while (p < end) {
+        const char *next = memchr(p, ',', end - p), *name, *nameEnd, *q;
+        int accepted = 1;
+
+        if (!next) next = end;
+
+        for (name = p; name < next && (*name == ' ' || *name == '\t'); name++);
+        for (nameEnd = name; nameEnd < next && *nameEnd != ';' && *nameEnd != ' ' && *nameEnd != '\t'; nameEnd++);
+
+        // A quality of 0, 0.0, 0.00... means "not acceptable"
+        if ((q = memchr(nameEnd, '=', next - nameEnd)) != NULL) {
+            for (q++; q < next && *q == ' '; q++);
+
+            if (q < next && *q == '0') {
+                for (q++; q < next && (*q == '.' || *q == '0'); q++);
+                for (; q < next && *q == ' '; q++);
+                if (q == next) accepted = 0;
+            }
+        }
+
+        if ((nameEnd - name == 4 && !strncasecmp(name, "gzip", 4)) ||
+            (nameEnd - name == 6 && !strncasecmp(name, "x-gzip", 6))) {
+            gzip = accepted;
+        } else if (nameEnd - name == 1 && *name == '*') {
+            any = accepted;
+        }
+
+        p = next + 1;
+    }
+
+    return gzip != -1 ? gzip : any == 1;
+}
+
+/* Keep the validators, the Range and the logged headers of a request on the
+ * connection, the values point into querybuf and are only valid while it
+ * is answered. */
+static void getHttpConditions(httpConn *c, RequestHeader *header) {
+    unsigned int i;
+
+    c->etags = NULL;
+    c->etagslen = 0;
+    c->since = -1;
+    c->range = NULL;
+    c->rangelen = 0;
+    c->ifrange = NULL;
+    c->ifrangelen = 0;
+
+    for (i = 0; i < header->HeaderSize; i++) {
+        HeaderField *field = header->Fields + i;
+
+        if (field->FieldNameLen == 13 && !strncasecmp(field->FieldName, "If-None-Match", 13)) {
+            c->etags = (char*) field->Value;
+            c->etagslen = field->ValueLen;
+        } else if (field->FieldNameLen == 17 && !strncasecmp(field->FieldName, "If-Modified-Since", 17)) {
+            c->since = parseHttpDate(field->Value, field->ValueLen);
+        } else if (field->FieldNameLen == 5 && !strncasecmp(field->FieldName, "Range", 5)) {
+            c->range = (char*) field->Value;
+            c->rangelen = field->ValueLen;
+        } else if (field->FieldNameLen == 8 && !strncasecmp(field->FieldName, "If-Range", 8)) {
+            c->ifrange = (char*) field->Value;
+            c->ifrangelen = field->ValueLen;
+        } else if (field->FieldNameLen == 7 && !strncasecmp(field->FieldName, "Referer", 7)) {
+            c->referer = (char*) field->Value;
+            c->refererlen = field->ValueLen;
+        } else if (field->FieldNameLen == 10 && !strncasecmp(field->FieldName, "User-Agent", 10)) {
+            c->agent = (char*) field->Value;
+            c->agentlen = field->ValueLen;
+        }
+    }
+}
+
+static int getHttpAcceptEncoding(RequestHeader *header) {
+    unsigned int i;
+
+    for (i = 0; i < header->HeaderSize; i++) {
+        HeaderField *field = header->Fields + i;
+
+        if (field->FieldNameLen == 15 && !strncasecmp(field->FieldName, "Accept-Encoding", 15)) {
+            return isHttpGzipAccepted(field->Value, field->ValueLen) ? HTTP_ACCEPT_GZIP : 0;
+        }
+    }
+
+    return 0;
+}
+
+/* Find the body the request announces, it has to be skipped to reach the
+ * next pipelined request. Returns its length, or -1 if it can't be framed. */
+static long long getHttpBodyLength(RequestHeader *header) {
+    long long length = 0;
+    unsigned int i;
+
+    for (i = 0; i < header->HeaderSize; i++) {
+        HeaderField *field = header->Fields + i;
+
+        if (field->FieldNameLen == 17 && !strncasecmp(field->FieldName, "Transfer-Encoding", 17)) {
+            return -1;
+        }
+
+        if (field->FieldNameLen == 14 && !strncasecmp(field->FieldName, "Content-Length", 14)) {
+            if (!string2ll(field->Value, field->ValueLen, &length) || length < 0) return -1;
+        }
+    }
+
+    return length;
+}
+
+/* Forget the request just answered */
+static void endHttpRequest(httpConn *c, int keepAlive) {
+    c->etags = NULL;
+    c->since = -1;
+    c->range = NULL;
+    c->ifrange = NULL;
+    c->method = HTTP_METHOD_GET;
+
+    // Set once the response is queued, replies are refused after it
+    if (!keepAlive) c->flags |= HTTP_CONN_CLOSE_AFTER_REPLY;
+}
+
+/* Answer one request, 'request' holds exactly its 'length' bytes of header */
+static void processHttpRequest(httpConn *c, char *request, int length) {
+    httpLoop *loop = c->loop;
+    char next = request[length];
+    int parsed;
+
+    // As h3_request_header_new() does, from the arena
+    RequestHeader *header = allocHttpRequest(loop, sizeof(*header));
+    memset(header, 0, sizeof(*header));
+
+    // h3 scans up to a null byte, keep it from reading the next request
+    request[length] = '\0';
+    parsed = h3_request_header_parse(header, request, length);
+    request[length] = next;
+
+    if (parsed < 0 || (c->bodylen = getHttpBodyLength(header)) < 0) {
+        c->bodylen = 0;
+        freeHttpRequest(loop, header);
+        responseHttpError(c, 400);
+        c->flags |= HTTP_CONN_CLOSE_AFTER_REPLY;
+        return;
+    }
+
+    if (!strncmp(header->RequestMethod, "GET ", 4) || !strncmp(header->RequestMethod, "get ", 4)) {
+        c->method = HTTP_METHOD_GET;
+    } else if (!strncmp(header->RequestMethod, "HEAD ", 5) || !strncmp(header->RequestMethod, "head ", 5)) {
+        c->method = HTTP_METHOD_HEAD;
+    } else {
+        freeHttpRequest(loop, header);
+        responseHttpError(c, 400);
+        c->flags |= HTTP_CONN_CLOSE_AFTER_REPLY;
+        return;
+    }
+
+    struct http_parser_url u;
+    int keepAlive = isHttpKeepAlive(header);
+    int cacheable = getHttpResponseCacheKey(loop, header->RequestURI, header->RequestURILen);
+
+    c->accept = getHttpAcceptEncoding(header);
+    getHttpConditions(c, header);
+
+    if (cacheable && lookupHttpResponseCache(c)) {
+        freeHttpRequest(loop, header);
+        endHttpRequest(c, keepAlive);
+        return;
+    }
+
+    char *fullUrl = dupHttpRequestString(loop, header->RequestURI, header->RequestURILen);
+
+    // Free header
+    freeHttpRequest(loop, header);
+
+    // Parse url
+    if (http_parser_parse_url(fullUrl, strlen(fullUrl), 0, &u)) {
+        loop->cacheFilling = 0;
+        freeHttpRequest(loop, fullUrl);
+        responseHttpError(c, 400);
+        c->flags |= HTTP_CONN_CLOSE_AFTER_REPLY;
+        return;
+    }
+
+    // Fields missing from the url are left uninitialized by the parser
+    char *urlPath = (u.field_set & (1 << UF_PATH)) ?
+        dupHttpRequestString(loop, fullUrl + u.field_data[UF_PATH].off, u.field_data[UF_PATH].len) :
+        dupHttpRequestString(loop, "/", 1);
+    char *urlQuery = (u.field_set & (1 << UF_QUERY)) ?
+        dupHttpRequestString(loop, fullUrl + u.field_data[UF_QUERY].off, u.field_data[UF_QUERY].len) :
+        dupHttpRequestString(loop, "", 0);
+
+    // Check if it has reload action, a worker leaves it to the main thread
+    if (server.reload_content_query && hasQueryParam(urlQuery, server.reload_content_query)) {
+        if (loop->worker) {
+            __sync_lock_test_and_set(&contentsReloadAsked, 1);
+        } else {
+            reloadContents();
+            emptyStaticFiles();
+        }
+    }
+
+    char *matches[ROUTE_MAX_MATCHES];
+    int numMatches = -1;
+    unsigned int i;
+    unsigned int isMatched = 0;
+
+    if (server.metrics_path[0] && !strcmp(urlPath, server.metrics_path)) {
+        isMatched = 1;
+        c->route = HTTP_ROUTE_METRICS;
+        responseHttpMetrics(c);
+    }
+
+    // Find matched route
+    for (i = 0; !isMatched && i < HTTP_NUM_ROUTES; i++) {
+        struct httpRoute *r = httpRoutes + i;
+
+        if ((numMatches = matchHttpRoute(r, urlPath, matches)) >= 0) {
+            isMatched = 1;
+            c->route = i;
+            r->callback(c, matches);
+
+            // Only the PCRE fallback allocates its captures
+            if (!r->matcher) {
+                while (numMatches--) zfree(matches[numMatches]);
+            }
+            break;
+        }
+    }
+
+    freeHttpRequest(loop, fullUrl);
+    freeHttpRequest(loop, urlPath);
+    freeHttpRequest(loop, urlQuery);
+
+    if (!isMatched) {
+        responseHttpError(c, 404);
+    }
+
+    if (loop->cacheFilling) storeHttpResponseCache(c);
+
+    endHttpRequest(c, keepAlive);
+}
+
+/* Run the request parser over the 'buflen' unread bytes at 'buf'. Requests
+ * are answered in order as soon as their header block is complete, bodies
+ * are skipped, and a partial header waits for the next read without being
+ * searched again from its start. Returns the bytes consumed, the caller
+ * keeps the rest. */
+static size_t processHttpInputBuffer(httpConn *c, char *buf, size_t buflen) {
+    size_t pos = 0;
+
+    while (!(c->flags & HTTP_CONN_CLOSE_AFTER_REPLY) && pos < buflen) {
+        char *request = buf + pos;
+        size_t available = buflen - pos;
+
+        if (c->reqstate == HTTP_REQ_BODY) {
+            if ((long long) available < c->bodylen) {
+                c->bodylen -= available;
+                pos = buflen;
+            } else {
+                pos += c->bodylen;
+                c->bodylen = 0;
+                c->reqstate = HTTP_REQ_HEADER;
+            }
+            continue;
+        }
+
+        // The terminator may straddle the previous read
+        size_t from = c->scanned > 3 ? c->scanned - 3 : 0;
+        char *end = memmem(request + from, available - from, "\r\n\r\n", 4);
+        size_t length = end ? (size_t) (end + 4 - request) : available;
+
+        if (length > server.http_max_header_size) {
+            long long start = ustime();
+
+            responseHttpError(c, 431);
+            recordHttpRequest(c, request, available, ustime() - start);
+            h3_mpool_clear(&c->loop->arena);
+            c->flags |= HTTP_CONN_CLOSE_AFTER_REPLY;
+            break;
+        }
+
+        if (!end) {
+            c->scanned = available;
+            break;
+        }
+
+        c->scanned = 0;
+
+        long long start = ustime();
+
+        processHttpRequest(c, request, length);
+        recordHttpRequest(c, request, length, ustime() - start);
+        h3_mpool_clear(&c->loop->arena);
+        pos += length;
+
+        if (c->bodylen > 0) c->reqstate = HTTP_REQ_BODY;
+    }
+
+    // Nothing else is answered on a closing connection
+    return (c->flags & HTTP_CONN_CLOSE_AFTER_REPLY) ? buflen : pos;
+}
+
+/* ============================ Http connections  ======================== */
+/* HTTP sockets don't go through the Redis clients: a connection only keeps
+ * its request parser state and a queue of reply objects, written with
+ * writev(2) and sendfile(2) as soon as a read event queued them. */
+static void readHttpConn(aeEventLoop *el, int fd, void *privdata, int mask);
+
+static const char *getHttpConnPeerId(httpConn *c) {
+    if (c->peer[0]) return c->peer;
+
+    if (c->flags & HTTP_CONN_UNIX_SOCKET) {
+        snprintf(c->peer, sizeof(c->peer), "%s:0", server.unixsocket);
+    } else {
+        anetFormatPeer(c->fd, c->peer, sizeof(c->peer));
+    }
+
+    return c->peer;
+}
+
+/* Queue 'length' bytes at 'offset' of the string 'o', or of 'file' when 'o'
+ * is NULL. A reference is taken unless the object is 'borrowed'. */
+static void addHttpConnReply(httpConn *c, robj *o, staticFile *file, off_t offset, size_t length,
+                             int borrowed)
+{
+    httpReply *reply;
+
+    if (c->firstReply + c->numReplies == c->repliesSize) {
+        if (c->firstReply > 0) {
+            memmove(c->replies, c->replies + c->firstReply, sizeof(httpReply) * c->numReplies);
+            c->firstReply = 0;
+        } else {
+            c->repliesSize = c->repliesSize ? c->repliesSize * 2 : HTTP_CONN_REPLIES;
+            c->replies = zrealloc(c->replies, sizeof(httpReply) * c->repliesSize);
+        }
+    }
+
+    // Replies borrowed from the snapshot keep it from being freed
+    if (borrowed && !c->ref) {
+        c->ref = c->loop->snapshot;
+        c->ref->pins++;
+    } else if (file) {
+        file->refcount++;
+    } else if (!borrowed) {
+        incrRefCount(o);
+    }
+
+    reply = c->replies + c->firstReply + c->numReplies++;
+    reply->o = o;
+    reply->file = file;
+    reply->offset = offset;
+    reply->length = length;
+    reply->borrowed = borrowed;
+}
+
+static void popHttpConnReply(httpConn *c) {
+    httpReply *reply = c->replies + c->firstReply;
+
+    if (reply->file) {
+        releaseStaticFile(reply->file);
+    } else if (!reply->borrowed) {
+        decrRefCount(reply->o);
+    }
+
+    c->firstReply++;
+    c->numReplies--;
+    c->sentlen = 0;
+}
+
+/* Stream the file range at the head of the queue from the page cache to the
+ * socket, without copying it through user space. At most
+ * NET_MAX_WRITES_PER_EVENT bytes are sent per call. */
+static ssize_t sendfileToHttpConn(httpConn *c) {
+    httpReply *reply = c->replies + c->firstReply;
+    size_t count = reply->length - c->sentlen;
+    off_t offset = reply->offset + c->sentlen;
+    ssize_t nwritten;
+
+    if (count > NET_MAX_WRITES_PER_EVENT) count = NET_MAX_WRITES_PER_EVENT;
+
+#ifdef HAVE_SENDFILE
+    nwritten = sendfile(c->fd, reply->file->fd, &offset, count);
+#else
+    {
+        char buf[PROTO_IOBUF_LEN];
+
+        if (count > sizeof(buf)) count = sizeof(buf);
+        nwritten = pread(reply->file->fd, buf, count, offset);
+        if (nwritten > 0) nwritten = write(c->fd, buf, nwritten);
+    }
+#endif
+    if (nwritten < 0) return nwritten;
+
+    // The file shrank under us: the promised length can't be sent
+    if (nwritten == 0) {
+        errno = EIO;
+        return -1;
+    }
+
+    c->sentlen += nwritten;
+    if (c->sentlen == reply->length) popHttpConnReply(c);
+    return nwritten;
+}
+
+/* Gather the head of the queue into one writev(2) call, then pop whatever
+ * was fully sent. A file range ends the batch, it is sent by
+ * sendfileToHttpConn() once it reaches the head. */
+static ssize_t writevToHttpConn(httpConn *c) {
+    struct iovec iov[NET_MAX_IOVCNT];
+    int iovcnt = 0, i, last = c->firstReply + c->numReplies;
+    size_t sent = c->sentlen;
+    ssize_t nwritten, remaining;
+
+    if (c->replies[c->firstReply].file) return sendfileToHttpConn(c);
+
+    for (i = c->firstReply; i < last && iovcnt < NET_MAX_IOVCNT; i++) {
+        httpReply *reply = c->replies + i;
+
+        if (reply->file) break;
+        if (reply->length > sent) {
+            iov[iovcnt].iov_base = (char*) reply->o->ptr + reply->offset + sent;
+            iov[iovcnt].iov_len = reply->length - sent;
+            iovcnt++;
+        }
+        sent = 0;
+    }
+
+    // Only empty objects are queued: drop them without a syscall
+    nwritten = iovcnt ? writev(c->fd, iov, iovcnt) : 0;
+    if (nwritten < 0) return nwritten;
+    remaining = nwritten;
+
+    while (c->numReplies) {
+        httpReply *reply = c->replies + c->firstReply;
+        size_t left;
+
+        if (reply->file) break;
+
+        left = reply->length - c->sentlen;
+        if ((size_t) remaining < left) {
+            c->sentlen += remaining;
+            break;
+        }
+
+        remaining -= left;
+        popHttpConnReply(c);
+    }
+
+    return nwritten;
+}
+
+/* A connection of the free list, its reply queue kept, or a new one */
+static httpConn *allocHttpConn(httpLoop *loop) {
+    httpConn *c = loop->freeConns;
+    httpReply *replies;
+    int repliesSize;
+
+    if (!c) return zcalloc(sizeof(*c));
+
+    loop->freeConns = c->next;
+    loop->numFreeConns--;
+
+    replies = c->replies;
+    repliesSize = c->repliesSize;
+    memset(c, 0, sizeof(*c));
+    c->replies = replies;
+    c->repliesSize = repliesSize;
+    return c;
+}
+
+/* Back to the free list: accepting connections at a high rate doesn't
+ * cost an allocation each */
+static void releaseHttpConn(httpLoop *loop, httpConn *c) {
+    if (loop->numFreeConns == HTTP_CONN_POOL_SIZE) {
+        zfree(c->replies);
+        zfree(c);
+        return;
+    }
+
+    c->next = loop->freeConns;
+    loop->freeConns = c;
+    loop->numFreeConns++;
+}
+
+static void freeHttpConn(httpConn *c) {
+    httpLoop *loop = c->loop;
+
+    aeDeleteFileEvent(loop->el, c->fd, AE_READABLE | AE_WRITABLE);
+    close(c->fd);
+
+    while (c->numReplies) popHttpConnReply(c);
+    if (c->ref) unpinHttpSnapshot(c->ref);
+
+    if (c->prev) c->prev->next = c->next;
+    else loop->conns = c->next;
+    if (c->next) c->next->prev = c->prev;
+
+    sdsfree(c->querybuf);
+    releaseHttpConn(loop, c);
+
+    __sync_sub_and_fetch(&httpConnections, 1);
+}
+
+static void sendHttpConnReplies(aeEventLoop *el, int fd, void *privdata, int mask);
+
+/* Write the queued replies, waiting for the socket to drain if they don't
+ * fit: reading stops meanwhile, pipelined requests wait in the kernel.
+ * Returns C_ERR if the connection was freed. */
+static int writeHttpConn(httpConn *c) {
+    aeEventLoop *el = c->loop->el;
+    ssize_t nwritten = 0, totwritten = 0;
+
+    while (c->numReplies) {
+        nwritten = writevToHttpConn(c);
+        if (nwritten < 0) break;
+
+        // A single connection doesn't hold the loop for long
+        totwritten += nwritten;
+        if (totwritten > NET_MAX_WRITES_PER_EVENT) break;
+    }
+
+    c->loop->netOutput += totwritten;
+
+    if (nwritten == -1 && errno != EAGAIN) {
+        serverLog(LL_VERBOSE, "Error writing to client: %s", strerror(errno));
+        freeHttpConn(c);
+        return C_ERR;
+    }
+
+    if (totwritten > 0) c->lastinteraction = server.unixtime;
+
+    if (c->numReplies) {
+        if (c->flags & HTTP_CONN_WRITE_HANDLER) return C_OK;
+
+        aeDeleteFileEvent(el, c->fd, AE_READABLE);
+        if (aeCreateFileEvent(el, c->fd, AE_WRITABLE, sendHttpConnReplies, c) == AE_ERR) {
+            freeHttpConn(c);
+            return C_ERR;
+        }
+
+        c->flags |= HTTP_CONN_WRITE_HANDLER;
+        return C_OK;
+    }
+
+    c->firstReply = 0;
+    if (c->ref) {
+        unpinHttpSnapshot(c->ref);
+        c->ref = NULL;
+    }
+
+    if (c->flags & HTTP_CONN_CLOSE_AFTER_REPLY) {
+        freeHttpConn(c);
+        return C_ERR;
+    }
+
+    if (c->flags & HTTP_CONN_WRITE_HANDLER) {
+        c->flags &= ~HTTP_CONN_WRITE_HANDLER;
+        aeDeleteFileEvent(el, c->fd, AE_WRITABLE);
+
+        if (aeCreateFileEvent(el, c->fd, AE_READABLE, readHttpConn, c) == AE_ERR) {
+            freeHttpConn(c);
+            return C_ERR;
+        }
+    }
+
+    return C_OK;
+}
+
+static void sendHttpConnReplies(aeEventLoop *el, int fd, void *privdata, int mask) {
+    UNUSED(el);
+    UNUSED(fd);
+    UNUSED(mask);
+
+    writeHttpConn((httpConn*) privdata);
+}
+
+/* Reads go to the buffer of the loop unless a partial request waits on the
+ * connection: an idle keep-alive connection holds no buffer. */
+static void readHttpConn(aeEventLoop *el, int fd, void *privdata, int mask) {
+    httpConn *c = (httpConn*) privdata;
+    httpLoop *loop = c->loop;
+    size_t buflen, pos;
+    ssize_t nread;
+    sds buf;
+
+    UNUSED(el);
+    UNUSED(mask);
+
+    if (c->querybuf) {
+        buf = c->querybuf = sdsMakeRoomFor(c->querybuf, PROTO_IOBUF_LEN);
+    } else {
+        buf = loop->readbuf;
+    }
+
+    buflen = sdslen(buf);
+    nread = read(fd, buf + buflen, PROTO_IOBUF_LEN);
+
+    if (nread == -1) {
+        if (errno == EAGAIN) return;
+
+        serverLog(LL_VERBOSE, "Reading from client: %s", strerror(errno));
+        freeHttpConn(c);
+        return;
+    } else if (nread == 0) {
+        serverLog(LL_VERBOSE, "Client closed connection");
+        freeHttpConn(c);
+        return;
+    }
+
+    sdsIncrLen(buf, nread);
+    c->lastinteraction = server.unixtime;
+
+    // Answer from the last published contents
+    if (loop->worker) refreshHttpSnapshot(loop);
+
+    pos = processHttpInputBuffer(c, buf, sdslen(buf));
+
+    if (buf == loop->readbuf) {
+        if (pos < sdslen(buf)) c->querybuf = sdsnewlen(buf + pos, sdslen(buf) - pos);
+        sdsclear(buf);
+    } else if (pos == sdslen(buf)) {
+        sdsfree(c->querybuf);
+        c->querybuf = NULL;
+    } else if (pos > 0) {
+        sdsrange(c->querybuf, pos, -1);
+    }
+
+    if (c->numReplies || (c->flags & HTTP_CONN_CLOSE_AFTER_REPLY)) writeHttpConn(c);
+}
+
+/* Refuse a connection with a best effort response, sent for free through
+ * the kernel buffer */
+static void rejectHttpConn(httpLoop *loop, int fd, const char *status, const char *reason) {
+    sds reply = sdscatfmt(sdsempty(),
+        "HTTP/1.1 %s\r\n"
+        "Server: Blogd\r\n"
+        "Cache-Control: " HTTP_CACHE_NONE "\r\n"
+        "Connection: close\r\n"
+        "Content-length: %u\r\n"
+        "Content-Type: text/plain\r\n\r\n"
+        "%s\n",
+        status, (unsigned int) strlen(reason) + 1, reason);
+
+    if (write(fd, reply, sdslen(reply)) == -1) {
+        // Nothing to do, just to avoid the warning
+    }
+
+    sdsfree(reply);
+    loop->rejectedConns++;
+    close(fd);
+}
+
+/* Serve the connection accepted on 'fd' from 'loop', once it passed the
+ * limits the Redis clients have: maxclients, the protected mode and the
+ * dataset loading, whose keys a 404 page saved meanwhile would clash with */
+static void createHttpConn(httpLoop *loop, int fd, int flags, char *ip) {
+    httpConn *c;
+
+    anetNonBlock(NULL, fd);
+
+    if (server.loading) {
+        rejectHttpConn(loop, fd, "503 Service Unavailable", "Blogd is loading the dataset in memory.");
+        return;
+    }
+
+    if (__sync_add_and_fetch(&httpConnections, 1) > (long long) server.maxclients) {
+        __sync_sub_and_fetch(&httpConnections, 1);
+        rejectHttpConn(loop, fd, "503 Service Unavailable", "Max number of clients reached.");
         return;
     }
-}
\ No newline at end of file
+
+    if (server.protected_mode && server.bindaddr_count == 0 && server.requirepass == NULL &&
+        !(flags & HTTP_CONN_UNIX_SOCKET) && ip != NULL && strcmp(ip, "127.0.0.1") && strcmp(ip, "::1"))
+    {
+        __sync_sub_and_fetch(&httpConnections, 1);
+        rejectHttpConn(loop, fd, "403 Forbidden",
+            "Blogd is running in protected mode: with no bind address and no password, "
+            "only the loopback interface is served. Set protected-mode no, a bind address "
+            "or a requirepass to serve other hosts.");
+        return;
+    }
+
+    anetEnableTcpNoDelay(NULL, fd);
+    if (server.tcpkeepalive) anetKeepAlive(NULL, fd, server.tcpkeepalive);
+
+    c = allocHttpConn(loop);
+    c->fd = fd;
+    c->flags = flags;
+    c->loop = loop;
+    c->lastinteraction = server.unixtime;
+    c->reqstate = HTTP_REQ_HEADER;
+    c->since = -1;
+    c->method = HTTP_METHOD_GET;
+    c->route = -1;
+
+    if (aeCreateFileEvent(loop->el, fd, AE_READABLE, readHttpConn, c) == AE_ERR) {
+        serverLog(LL_WARNING, "Error registering fd event for the new client: %s (fd=%d)",
+            strerror(errno), fd);
+        close(fd);
+        releaseHttpConn(loop, c);
+        __sync_sub_and_fetch(&httpConnections, 1);
+        return;
+    }
+
+    c->next = loop->conns;
+    if (loop->conns) loop->conns->prev = c;
+    loop->conns = c;
+    loop->numConnections++;
+}
+
+/* Called by the accept handlers of the main thread */
+void acceptHttpConn(int fd, int flags, char *ip) {
+    createHttpConn(httpLoops, fd, (flags & CLIENT_UNIX_SOCKET) ? HTTP_CONN_UNIX_SOCKET : 0, ip);
+}
+
+/* Flush the access log, and close the connections idle for longer than
+ * the Redis clients timeout, checked once per second */
+static void httpLoopCron(httpLoop *loop) {
+    httpConn *c, *next;
+
+    flushAccessLog(loop);
+    if (loop->worker) refreshHttpSnapshot(loop);
+
+    if (!server.maxidletime || loop->idleCheckedAt == server.unixtime) return;
+    loop->idleCheckedAt = server.unixtime;
+
+    for (c = loop->conns; c; c = next) {
+        next = c->next;
+
+        if (server.unixtime - c->lastinteraction > server.maxidletime) {
+            serverLog(LL_VERBOSE, "Closing idle client");
+            freeHttpConn(c);
+        }
+    }
+}
+
+/* Called by serverCron(). The counters of the server stats are only
+ * written here, by the main thread, from the ones each loop keeps. */
+void httpCron(void) {
+    int i;
+
+    httpLoopCron(httpLoops);
+    freeReleasedHttpSnapshots();
+
+    for (i = 0; i < httpNumLoops; i++) {
+        httpLoop *loop = httpLoops + i;
+        long long output = __atomic_load_n(&loop->netOutput, __ATOMIC_RELAXED);
+        long long accepted = __atomic_load_n(&loop->numConnections, __ATOMIC_RELAXED);
+        long long rejected = __atomic_load_n(&loop->rejectedConns, __ATOMIC_RELAXED);
+
+        server.stat_net_output_bytes += output - loop->netOutputSeen;
+        loop->netOutputSeen = output;
+        server.stat_numconnections += accepted - loop->numConnectionsSeen;
+        loop->numConnectionsSeen = accepted;
+        server.stat_rejected_conn += rejected - loop->rejectedConnsSeen;
+        loop->rejectedConnsSeen = rejected;
+    }
+}
+
+/* ============================ Http workers  ======================== */
+/* With http-workers, each worker thread runs its own event loop over its
+ * own SO_REUSEPORT listening sockets: the kernel spreads the connections
+ * between them, the main thread only keeps the unix socket. */
+static void initHttpLoop(httpLoop *loop, aeEventLoop *el, int worker) {
+    loop->el = el;
+    loop->worker = worker;
+    loop->readbuf = sdsMakeRoomFor(sdsempty(), PROTO_IOBUF_LEN);
+    loop->lookupKey = sdsempty();
+    loop->filePath = sdsempty();
+    h3_mpool_init(&loop->arena, zmalloc(HTTP_REQUEST_ARENA_SIZE), HTTP_REQUEST_ARENA_SIZE);
+    loop->notModified = createStringObject("HTTP/1.1 304 Not Modified\r\n", 27);
+    loop->crlf = createStringObject("\r\n", 2);
+    loop->staticFiles = dictCreate(&staticFileDictType, NULL);
+    loop->staticMemory = dictCreate(&dbDictType, NULL);
+    loop->staticEpoch = httpStaticEpoch;
+    loop->responseCache = dictCreate(&httpResponseCacheDictType, NULL);
+    loop->cacheKey = sdsempty();
+    loop->routeStats = zcalloc(sizeof(httpStats) * (HTTP_NUM_ROUTES + 2));
+    loop->statusStats = zcalloc(sizeof(httpStats) * (HTTP_NUM_STATUS_CODES + 1));
+    loop->accessLogTimeAt = -1;
+
+    if (accessLogFd == -1) return;
+
+    loop->accessLogSize = server.http_workers ? server.access_log_buffer / server.http_workers :
+        server.access_log_buffer;
+    if (loop->accessLogSize < HTTP_ACCESS_LOG_MIN_BUFFER) loop->accessLogSize = HTTP_ACCESS_LOG_MIN_BUFFER;
+
+    loop->accessLog[0].buf = zmalloc(loop->accessLogSize);
+    loop->accessLog[1].buf = zmalloc(loop->accessLogSize);
+    loop->accessLogActive = loop->accessLog;
+}
+
+static void acceptHttpWorkerHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
+    int cport, cfd, max = HTTP_MAX_ACCEPTS_PER_CALL;
+    char cip[NET_IP_STR_LEN], err[ANET_ERR_LEN];
+
+    UNUSED(el);
+    UNUSED(mask);
+
+    while (max--) {
+        cfd = anetTcpAccept(err, fd, cip, sizeof(cip), &cport);
+
+        if (cfd == ANET_ERR) {
+            if (errno != EWOULDBLOCK) serverLog(LL_WARNING, "Accepting client connection: %s", err);
+            return;
+        }
+
+        serverLog(LL_VERBOSE, "Accepted %s:%d", cip, cport);
+        createHttpConn((httpLoop*) privdata, cfd, 0, cip);
+    }
+}
+
+static int httpWorkerCron(aeEventLoop *el, long long id, void *clientData) {
+    UNUSED(el);
+    UNUSED(id);
+
+    httpLoopCron((httpLoop*) clientData);
+    return HTTP_WORKER_CRON_MS;
+}
+
+static void *runHttpWorker(void *arg) {
+    httpLoop *loop = arg;
+    sigset_t sigset;
+
+    // The watchdog signal is for the main thread, like with the bio threads
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGALRM);
+    if (pthread_sigmask(SIG_BLOCK, &sigset, NULL)) {
+        serverLog(LL_WARNING, "Warning: can't mask SIGALRM in http worker thread: %s", strerror(errno));
+    }
+
+    aeMain(loop->el);
+    return NULL;
+}
+
+/* The descriptors kept open besides the clients and CONFIG_MIN_RESERVED_FDS:
+ * the cached static files, then the listening sockets and the event loop
+ * of each worker. Their numbers must fit the setsize of every loop. */
+int getHttpReservedFds(void) {
+    int listeners = server.port == 0 ? 0 : server.bindaddr_count ? server.bindaddr_count : 2;
+
+    return server.static_fd_cache + server.http_workers * (listeners + 1);
+}
+
+/* The main loop, and the workers started with their sockets. Called
+ * before the dataset loads: the workers serve an empty snapshot until
+ * publishHttpSnapshot() is called with the loaded responses. */
+void initHttpLoops(void) {
+    int i, j;
+
+    httpNumLoops = server.http_workers + 1;
+    httpLoops = zcalloc(sizeof(httpLoop) * httpNumLoops);
+    initHttpLoop(httpLoops, server.el, 0);
+
+    if (!server.http_workers) return;
+
+    publishHttpSnapshot();
+
+    for (i = 1; i < httpNumLoops; i++) {
+        httpLoop *loop = httpLoops + i;
+
+        initHttpLoop(loop, aeCreateEventLoop(server.maxclients + CONFIG_FDSET_INCR + getHttpReservedFds()), 1);
+
+        if (server.port != 0 && listenToPort(server.port, loop->ipfd, &loop->ipfdCount) == C_ERR) exit(1);
+
+        for (j = 0; j < loop->ipfdCount; j++) {
+            if (aeCreateFileEvent(loop->el, loop->ipfd[j], AE_READABLE, acceptHttpWorkerHandler, loop) == AE_ERR) {
+                serverPanic("Unrecoverable error creating http worker file event.");
+            }
+        }
+
+        if (aeCreateTimeEvent(loop->el, 1, httpWorkerCron, loop, NULL) == AE_ERR) {
+            serverPanic("Can't create the http worker cron.");
+        }
+
+        refreshHttpSnapshot(loop);
+
+        if (pthread_create(&loop->thread, NULL, runHttpWorker, loop) != 0) {
+            serverLog(LL_WARNING, "Fatal: Can't initialize http worker %d.", i);
+            exit(1);
+        }
+    }
+}
+
+/* On shutdown: the workers finish the event they are in, their
+ * connections are left to the exit */
+void stopHttpWorkers(void) {
+    int i, j;
+
+    for (i = 1; i < httpNumLoops; i++) aeStop(httpLoops[i].el);
+
+    for (i = 1; i < httpNumLoops; i++) {
+        pthread_join(httpLoops[i].thread, NULL);
+        for (j = 0; j < httpLoops[i].ipfdCount; j++) close(httpLoops[i].ipfd[j]);
+    }
+}
+
+/* ============================ Tests  ======================== */
+#ifdef BLOGD_TEST
+/* Built by "make test-blogd", linked with the allocators wrapped. Once the
+ * caches are warm, serving a request must not allocate: everything comes
+ * from the request arena, the response cache and the open static files. */
+static long long testAllocs;
+
+void *__real_zmalloc(size_t size);
+void *__real_zcalloc(size_t size);
+void *__real_zrealloc(void *ptr, size_t size);
+char *__real_zstrdup(const char *s);
+void *__real_malloc(size_t size);
+
+void *__wrap_zmalloc(size_t size) {
+    __sync_add_and_fetch(&testAllocs, 1);
+    return __real_zmalloc(size);
+}
+
+void *__wrap_zcalloc(size_t size) {
+    __sync_add_and_fetch(&testAllocs, 1);
+    return __real_zcalloc(size);
+}
+
+void *__wrap_zrealloc(void *ptr, size_t size) {
+    __sync_add_and_fetch(&testAllocs, 1);
+    return __real_zrealloc(ptr, size);
+}
+
+char *__wrap_zstrdup(const char *s) {
+    __sync_add_and_fetch(&testAllocs, 1);
+    return __real_zstrdup(s);
+}
+
+// h3_mpool_malloc() falls back to it when the arena is full
+void *__wrap_malloc(size_t size) {
+    __sync_add_and_fetch(&testAllocs, 1);
+    return __real_malloc(size);
+}
+
+#define BLOGD_TEST_ROUNDS 1000
+
+typedef struct testRequest {
+    char path[256];
+    const char *headers;
+    int status;
+} testRequest;
+
+/* Send a request on 'fd' and run the main loop until the whole response is
+ * back. 1 if it came with 'status'. */
+static int sendTestRequest(int fd, testRequest *r) {
+    static char buf[1024 * 1024];
+    char req[512];
+    size_t len = 0, expected = 0;
+    long spins = 0;
+    int n = snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\nHost: localhost\r\n%s\r\n", r->path, r->headers);
+
+    if (write(fd, req, n) != n) return 0;
+
+    while (!expected || len < expected) {
+        ssize_t nread;
+        char *end, *field;
+
+        if (++spins > 1000000 || len == sizeof(buf) - 1) return 0;
+
+        aeProcessEvents(server.el, AE_FILE_EVENTS | AE_DONT_WAIT);
+        if ((nread = recv(fd, buf + len, sizeof(buf) - 1 - len, MSG_DONTWAIT)) == 0) return 0;
+        if (nread < 0) {
+            if (errno == EAGAIN) continue;
+            return 0;
+        }
+
+        len += nread;
+        buf[len] = '\0';
+
+        if (!expected && (end = strstr(buf, "\r\n\r\n")) != NULL) {
+            field = strcasestr(buf, "\r\nContent-length: ");
+            expected = end + 4 - buf + (field && field < end ? strtoul(field + 18, NULL, 10) : 0);
+        }
+    }
+
+    return len == expected && len > 12 && atoi(buf + 9) == r->status;
+}
+
+/* redis-server test blogd <content-dir> <public-dir> */
+int blogdTest(int argc, char **argv) {
+    char err[ANET_ERR_LEN], sock[64];
+    testRequest reqs[] = {
+        {"/", "", 200},
+        {"", "", 200},
+        {"", "", 200},
+        {"", "Accept-Encoding: gzip\r\n", 200},
+        {"/blogd-test-not-found", "", 404}
+    };
+    unsigned int numReqs = sizeof(reqs) / sizeof(testRequest), i;
+    long long allocs;
+    int fd, round, failed = 0;
+
+    UNUSED(argc);
+
+    zfree(server.content_dir);
+    zfree(server.public_dir);
+    server.content_dir = zstrdup(argv[3]);
+    server.public_dir = zstrdup(argv[4]);
+    server.verbosity = LL_WARNING;
+    server.port = 0;
+    server.http_workers = 0;
+    server.content_watch = 0;
+    snprintf(sock, sizeof(sock), "/tmp/blogd-test-%d.sock", (int) getpid());
+    server.unixsocket = zstrdup(sock);
+
+    initServer();
+    initHttpRoutes();
+    initHttpLoops();
+    initContents(server.content_dir);
+
+    // Any post and any compressible public file
+    if (!dictSize(server.contents->posts) || !dictSize(server.contents->files)) {
+        printf("[blogd] %s has no post or %s no compressible file\n", argv[3], argv[4]);
+        return 1;
+    }
+
+    snprintf(reqs[1].path, sizeof(reqs[1].path), "/%s", (char*) dictGetKey(dictGetRandomKey(server.contents->posts)));
+    snprintf(reqs[2].path, sizeof(reqs[2].path), "%s", (char*) dictGetKey(dictGetRandomKey(server.contents->files)));
+    memcpy(reqs[3].path, reqs[2].path, sizeof(reqs[3].path));
+
+    if ((fd = anetUnixConnect(err, sock)) == ANET_ERR) {
+        printf("[blogd] %s\n", err);
+        return 1;
+    }
+
+    // Warm up: the response cache, the static files, the buffers
+    for (round = 0; round < 3; round++) {
+        for (i = 0; i < numReqs; i++) {
+            if (!sendTestRequest(fd, reqs + i)) {
+                printf("[blogd] GET %s: no %d response\n", reqs[i].path, reqs[i].status);
+                return 1;
+            }
+        }
+    }
+
+    for (i = 0; i < numReqs; i++) {
+        allocs = testAllocs;
+
+        for (round = 0; round < BLOGD_TEST_ROUNDS; round++) {
+            if (!sendTestRequest(fd, reqs + i)) failed = 1;
+        }
+
+        allocs = testAllocs - allocs;
+        printf("[blogd] GET %s%s: %lld allocations in %d requests\n", reqs[i].path,
+               reqs[i].headers[0] ? " (gzip)" : "", allocs, BLOGD_TEST_ROUNDS);
+        if (allocs) failed = 1;
+    }
+
+    close(fd);
+    unlink(sock);
+    printf("[blogd] %s\n", failed ? "FAILED: the request path allocates" : "OK");
+    return failed;
+}
+#endif
@@ -4,42 +4,299 @@
 #include "ae.h"
 #include "sds.h"
 
+#include <sys/types.h>
+#include <stdint.h>
+#include <time.h>
+
+#define BLOGD_KEY_PREFIX "blogd::"  /* Of every key below */
 #define PAGE_KEY_PREFIX "blogd::page"
 #define PAGE_ERROR_KEY_PREFIX "blogd::page::error"
 #define POST_KEY_PREFIX "blogd::post::"
+#define STATIC_KEY_PREFIX "blogd::static::"
+#define GZIP_KEY_PREFIX "blogd::gzip::"  /* + the key of the uncompressed response */
+#define CONTENT_MANIFEST_KEY "blogd::manifest"
+
+#define CONTENT_MANIFEST_VERSION 1 /* Bump when the compiled responses change format */
+
+#define HTTP_GZIP_LEVEL 9 /* Compression runs once per compile, never per request */
+#define HTTP_GZIP_MAX_FILE (16*1024*1024) /* Larger public files are only sent plain */
+#define HTTP_STATIC_MAX_DEPTH 16          /* Public dir levels searched for files to compress */
+#define HTTP_STATIC_MEMORY_MAX_FILE (1024*1024) /* Larger files stay on sendfile(2) */
+
+/* Response variants, see buildHttpHeaders() */
+#define HTTP_ENCODING_NONE 0     /* The only variant there is */
+#define HTTP_ENCODING_IDENTITY 1 /* Uncompressed, a gzip variant may exist */
+#define HTTP_ENCODING_GZIP 2
+
+/* httpConn accept flags, from the request's Accept-Encoding */
+#define HTTP_ACCEPT_GZIP (1<<0)
+
+#define HTTP_CACHE_NONE "no-store" /* Cache-Control of the error responses */
+
+/* httpConn method */
+#define HTTP_METHOD_GET 0
+#define HTTP_METHOD_HEAD 1  /* Same headers as GET, no body */
+
+#define HTTP_MAX_RANGES 16  /* A Range with more parts gets the whole file */
+#define HTTP_RANGES_BOUNDARY "blogd-byteranges-6f1c2a9d48e3b507"
+
+/* Request parser states, see processHttpInputBuffer() */
+#define HTTP_REQ_HEADER 0 /* Accumulating the header block up to "\r\n\r\n" */
+#define HTTP_REQ_BODY 1   /* Discarding the body announced by Content-Length */
 
-typedef void httpRouteCallback(void *cl, char **matches, int readlen, size_t qblen);
+/* httpConn flags */
+#define HTTP_CONN_CLOSE_AFTER_REPLY (1<<0) /* Close once the queued replies are sent */
+#define HTTP_CONN_WRITE_HANDLER (1<<1)     /* Waiting for the socket to drain, not reading */
+#define HTTP_CONN_UNIX_SOCKET (1<<2)
+
+#define HTTP_CONN_REPLIES 8        /* Initial size of the reply queue of a connection */
+#define HTTP_CONN_POOL_SIZE 1024   /* Freed connections each loop keeps for reuse */
+#define HTTP_CONN_PEER_LEN (46+32) /* NET_PEER_ID_LEN, defined by server.h after this file */
+#define HTTP_REQUEST_ARENA_SIZE (32*1024) /* Per loop, larger requests spill to malloc */
+#define HTTP_RESPONSE_CACHE_MAX_PATH 512  /* Longer paths are routed every time */
+#define HTTP_MAX_WORKERS 256
+#define HTTP_WORKER_CRON_MS 100    /* Period of the cron of each http worker */
+#define HTTP_MAX_ACCEPTS_PER_CALL 1000
+
+/* Access log line formats */
+#define HTTP_ACCESS_LOG_COMMON 0
+#define HTTP_ACCESS_LOG_COMBINED 1  /* Common, with Referer and User-Agent */
+#define HTTP_ACCESS_LOG_JSON 2
+#define HTTP_ACCESS_LOG_MAX_FIELD 1024  /* Longer request lines and headers are cut */
+#define HTTP_ACCESS_LOG_MIN_BUFFER (16*1024) /* Of each buffer, once split between the loops */
+
+/* Log-linear latency buckets, see httpLatencyBucket(): every power of two
+ * of microseconds is split in HTTP_LATENCY_SUB_BUCKETS, so a percentile is
+ * off by 12.5% at most. Latencies go up to 2^32 usec. */
+#define HTTP_LATENCY_SUB_BITS 3
+#define HTTP_LATENCY_SUB_BUCKETS (1<<HTTP_LATENCY_SUB_BITS)
+#define HTTP_LATENCY_BUCKETS ((32 - HTTP_LATENCY_SUB_BITS + 1) * HTTP_LATENCY_SUB_BUCKETS)
+
+typedef void httpRouteCallback(void *cl, char **matches);
+typedef int httpRouteMatcher(char *path, char **matches);
 
 typedef struct httpMime {
     char *ext;
     char *filetype;
+    int compress;   /* Worth a precompressed gzip variant */
 } httpMime;
 
+/* Caching headers of a response, see buildHttpHeaders() */
+typedef struct httpCache {
+    const char *control;  /* Cache-Control value */
+    uint64_t etag;        /* Hash of the uncompressed body, 0 for no ETag */
+    time_t lastModified;  /* 0 for no Last-Modified */
+    int ranges;           /* Served by offset, "Accept-Ranges: bytes" */
+} httpCache;
+
+/* A satisfiable part of a Range request, 'end' included */
+typedef struct httpRange {
+    off_t start;
+    off_t end;
+} httpRange;
+
 typedef struct httpRoute {
+    char *name;                /* Label of its metrics */
     char *pattern;
     httpRouteCallback *callback;
+    httpRouteMatcher *matcher; /* Hand-written matcher, NULL to use pattern */
+    void *re;                  /* Pattern compiled once by initHttpRoutes() */
 } httpRoute;
 
-/* Redis helpers */
-int formatRedisCommand(char **cmd, int argc, char **argv);
-int buildRedisCommand(char **cmd, char *argvs[], int argc);
-void executeRedisCommand(char **argvs, unsigned int argc);
-void callRedisCommand(void *cl, int readlen, size_t qblen, char **argvs, int argc);
+/* Requests answered by a route or with a status code */
+typedef struct httpStats {
+    long long requests;
+    long long sent;        /* Response bytes queued */
+    long long usec;        /* Total time spent answering */
+    long long maxUsec;
+    long long latency[HTTP_LATENCY_BUCKETS];
+} httpStats;
+
+/* Access log lines waiting to be written, see flushAccessLog() */
+typedef struct accessLogBuffer {
+    char *buf;
+    size_t len;
+    int writing;    /* Handed to the bio thread, under accessLogLock */
+} accessLogBuffer;
+
+/* A file under public dir, opened once and shared by every reply that
+ * streams it. Cached files are also referenced by the staticFiles dict of
+ * the event loop that opened them, the only one using it. */
+typedef struct staticFile {
+    int fd;
+    off_t size;
+    struct redisObject *headers; /* Pre-built "200 OK" response headers */
+    int refcount;
+} staticFile;
+
+/* The blogd:: responses of the keyspace, frozen for the http workers that
+ * can't read the keyspace itself. Built and freed by the main thread, only
+ * read by the workers. The responses are shared with the keyspace. */
+typedef struct httpSnapshot {
+    dict *responses;            /* Key -> response, each one holding a refcount */
+    int refcount;               /* Workers using it, and the main thread while it
+                                 * is the published one. Under httpSnapshotLock */
+    struct httpSnapshot *next;  /* In the list of snapshots to free */
+} httpSnapshot;
+
+/* The use of a snapshot by one event loop: pinned by the loop while it is
+ * its current one, and by each connection with replies borrowed from it */
+typedef struct httpSnapshotRef {
+    httpSnapshot *snapshot;
+    long pins;
+} httpSnapshotRef;
+
+/* A part of a response, queued on a connection: a range of a string object,
+ * or of a static file sent with sendfile(2) */
+typedef struct httpReply {
+    struct redisObject *o;  /* NULL for a file */
+    staticFile *file;       /* Holding a reference */
+    off_t offset;
+    size_t length;
+    int borrowed;           /* 'o' lives in the snapshot the connection pins, no refcount taken */
+} httpReply;
+
+/* The responses a request path was routed to, see lookupHttpResponseCache() */
+typedef struct httpCachedResponse {
+    struct redisObject *response;  /* The plain variant, or the only one */
+    struct redisObject *gzip;      /* NULL if none */
+    int route;                     /* Index in httpRoutes, -1 if none matched */
+    int borrowed;                  /* From the snapshot of a worker, no refcount taken */
+} httpCachedResponse;
+
+/* An HTTP connection, served by the single event loop that accepted it.
+ * Freed ones go to a free list of the loop, see freeHttpConn(). */
+typedef struct httpConn {
+    int fd;
+    int flags;              /* HTTP_CONN_* */
+    struct httpLoop *loop;
+    struct httpConn *prev;  /* In the connections of the loop */
+    struct httpConn *next;  /* Or in its free list */
+    time_t lastinteraction;
+    char peer[HTTP_CONN_PEER_LEN]; /* "ip:port", formatted the first time it is logged */
+    sds querybuf;           /* A partial request left by the last read, NULL if none */
+    int reqstate;           /* HTTP_REQ_HEADER or HTTP_REQ_BODY */
+    size_t scanned;         /* Header bytes already searched for "\r\n\r\n" */
+    long long bodylen;      /* Request body bytes left to discard */
+    int accept;             /* HTTP_ACCEPT_* encodings of the current request */
+    char *etags;            /* Its If-None-Match, NULL if none */
+    size_t etagslen;
+    time_t since;           /* Its If-Modified-Since, -1 if none */
+    int method;             /* HTTP_METHOD_GET or HTTP_METHOD_HEAD */
+    char *range;            /* Its Range, NULL if none */
+    size_t rangelen;
+    char *ifrange;          /* Its If-Range, NULL if none */
+    size_t ifrangelen;
+    int route;              /* Index in httpRoutes of the current request, -1 if none */
+    int status;             /* Status code of its response, once queued */
+    size_t sent;            /* Response bytes queued for it */
+    char *referer;          /* Its Referer, NULL if none */
+    size_t refererlen;
+    char *agent;            /* Its User-Agent, NULL if none */
+    size_t agentlen;
+    httpReply *replies;     /* Queued replies, sent in order */
+    int firstReply;         /* The next one to send */
+    int numReplies;
+    int repliesSize;
+    size_t sentlen;         /* Bytes of replies[firstReply] already sent */
+    httpSnapshotRef *ref;   /* Pinned while borrowed replies are queued */
+} httpConn;
+
+/* What the last content load knew about a post, to skip it when unchanged */
+typedef struct contentPost {
+    time_t mtime;
+    off_t size;
+    uint64_t hash;         /* crc64 of the post file */
+    sds summary;           /* The post's entry in the pagination pages */
+    uint64_t summaryHash;
+    unsigned long epoch;   /* Load that last saw the file */
+    int queued;            /* A file of the load already compiles it */
+} contentPost;
+
+/* What the last content load knew about a compressed static file */
+typedef struct contentFile {
+    time_t mtime;
+    off_t size;
+    unsigned long epoch;
+} contentFile;
+
+/* Responses compiled off the main thread, waiting to be swapped in */
+typedef struct contentGeneration {
+    sds contentDir;
+    sds publicDir;
+    dict *responses;   /* Key -> pre-serialized response to set */
+    list *deleted;     /* Keys to delete */
+} contentGeneration;
+
+/* State kept between content loads, see compileContents() */
+typedef struct contentIndex {
+    dict *posts;             /* Post name -> contentPost */
+    dict *files;             /* Public file path -> contentFile, compressed ones only */
+    uint64_t *pages;         /* Signature of each pagination page */
+    unsigned long numPages;
+    uint64_t templates;      /* Signature of the templates and page settings */
+    unsigned long epoch;
+    time_t scanned;          /* When the last load started: a file changed in that
+                              * second may have changed again after it was read */
+} contentIndex;
 
 /* Redis commands */
 int getRedisNoReplyCommand(void *cl);
+struct redisObject *lookupHttpResponse(void *cl, const char *prefix, const char *suffix);
+
+/* Static files */
+staticFile *lookupStaticFile(struct httpLoop *loop, sds path, char *ext);
+void releaseStaticFile(staticFile *file);
+void forgetStaticFile(sds path);
+void emptyStaticFiles(void);
 
 /* Main */
+void initHttpRoutes(void);
+contentIndex *createContentIndex(void);
+void freeContentPost(contentPost *post);
+contentGeneration *createContentGeneration(char *content_dir, char *public_dir);
+void freeContentGeneration(contentGeneration *gen);
+int compileContents(contentGeneration *gen);
+void applyContentGeneration(contentGeneration *gen);
 void initContents(char *content_dir);
-void processHttpRequestFromClient(aeEventLoop *el, int fd, void *privdata, int mask);
+void reloadContents(void);
+void compileContentsJob(void *arg);
+void initContentsWatch(void);
+void contentsCron(void);
+
+/* Metrics */
+void resetHttpStats(void);
+sds genHttpInfoString(sds info);
+
+/* Access log */
+void initAccessLog(void);
+void writeAccessLogJob(void *arg);
+void closeAccessLog(void);
+
+/* Response cache */
+void freeHttpCachedResponse(httpCachedResponse *cached);
+void touchHttpResponseCache(struct redisObject *key);
+
+/* Connections */
+int getHttpReservedFds(void);
+void initHttpLoops(void);
+void acceptHttpConn(int fd, int flags, char *ip);
+void publishHttpSnapshot(void);
+void httpCron(void);
+void stopHttpWorkers(void);
 
 /* Response */
-sds *buildHttpHeaders(char *contentType, unsigned int contentLength, unsigned int code);
-void responseHttp(void *cl, char *content, char *contentType, unsigned int code);
-void responseHttpIndex(void *cl, char **matches, int readlen, size_t qblen);
-void responseHttpPage(void *cl, char **matches, int readlen, size_t qblen);
-void responseHttpContent(void *cl, char **matches, int readlen, size_t qblen);
-void responseHttpFile(void *cl, char **matches, int readlen, size_t qblen);
-void responseHttpError(void *cl, int readlen, size_t qblen, int code);
+sds buildHttpHeaders(const char *contentType, size_t contentLength, int code, int encoding,
+                     const httpCache *cache);
+void responseHttp(void *cl, void *response);
+void responseHttpIndex(void *cl, char **matches);
+void responseHttpPage(void *cl, char **matches);
+void responseHttpContent(void *cl, char **matches);
+void responseHttpFile(void *cl, char **matches);
+void responseHttpError(void *cl, int code);
+
+#ifdef BLOGD_TEST
+int blogdTest(int argc, char **argv);
+#endif
 
 #endif
@@ -82,6 +82,14 @@ configEnum supervised_mode_enum[] = {
     {NULL, 0}
 };
 
+/* Extend */
+configEnum access_log_format_enum[] = {
+    {"common", HTTP_ACCESS_LOG_COMMON},
+    {"combined", HTTP_ACCESS_LOG_COMBINED},
+    {"json", HTTP_ACCESS_LOG_JSON},
+    {NULL, 0}
+};
+
 configEnum aof_fsync_enum[] = {
     {"everysec", AOF_FSYNC_EVERYSEC},
     {"always", AOF_FSYNC_ALWAYS},
@@ -460,6 +468,89 @@ void loadServerConfigFromString(char *config) {
             server.reload_content_query = zstrdup(argv[1]);
         } else if (!strcasecmp(argv[0],"markdown-compile") && argc == 2) {
             server.markdown_compile = memtoll(argv[1], NULL);
+        } else if (!strcasecmp(argv[0],"static-fd-cache") && argc == 2) {
+            server.static_fd_cache = memtoll(argv[1], NULL);
+        } else if (!strcasecmp(argv[0],"static-memory-cache") && argc == 2) {
+            server.static_memory_cache = memtoll(argv[1], NULL);
+        } else if (!strcasecmp(argv[0],"response-cache-entries") && argc == 2) {
+            server.response_cache_entries = memtoll(argv[1], NULL);
+        } else if (!strcasecmp(argv[0],"http-max-header-size") && argc == 2) {
+            server.http_max_header_size = memtoll(argv[1], NULL);
+            if (server.http_max_header_size < 16) {
+                err = "http-max-header-size must be at least 16 bytes"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"markdown-extensions") && argc == 2) {
+            int flags = markdownExtensionsFromString(argv[1]);
+
+            if (flags == -1) {
+                err = "Invalid markdown extension. Use 'tables', 'fenced-code', 'autolink', "
+                      "'strikethrough', 'superscript', 'no-intra-emphasis', 'space-headers' "
+                      "or 'lax-spacing'.";
+                goto loaderr;
+            }
+            server.markdown_extensions = flags;
+        } else if (!strcasecmp(argv[0],"cache-control-pages") && argc == 2) {
+            zfree(server.cache_control_pages);
+            server.cache_control_pages = zstrdup(argv[1]);
+        } else if (!strcasecmp(argv[0],"cache-control-posts") && argc == 2) {
+            zfree(server.cache_control_posts);
+            server.cache_control_posts = zstrdup(argv[1]);
+        } else if (!strcasecmp(argv[0],"cache-control-static") && argc == 2) {
+            zfree(server.cache_control_static);
+            server.cache_control_static = zstrdup(argv[1]);
+        } else if (!strcasecmp(argv[0],"content-watch") && argc == 2) {
+            if ((server.content_watch = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"content-watch-delay") && argc == 2) {
+            server.content_watch_delay = strtoll(argv[1], NULL, 10);
+            if (server.content_watch_delay < 0) {
+                err = "content-watch-delay can't be negative"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"metrics-path") && argc == 2) {
+            zfree(server.metrics_path);
+            server.metrics_path = zstrdup(argv[1]);
+        } else if (!strcasecmp(argv[0],"access-log") && argc == 2) {
+            zfree(server.access_log);
+            server.access_log = zstrdup(argv[1]);
+            if (server.access_log[0] != '\0') {
+                FILE *logfp = fopen(server.access_log,"a");
+
+                if (logfp == NULL) {
+                    err = sdscatprintf(sdsempty(),
+                        "Can't open the access log: %s", strerror(errno));
+                    goto loaderr;
+                }
+                fclose(logfp);
+            }
+        } else if (!strcasecmp(argv[0],"access-log-format") && argc == 2) {
+            server.access_log_format = configEnumGetValue(access_log_format_enum,argv[1]);
+            if (server.access_log_format == INT_MIN) {
+                err = "argument must be 'common', 'combined' or 'json'";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"access-log-sample") && argc == 2) {
+            long long sample = strtoll(argv[1], NULL, 10);
+
+            if (sample < 1 || sample > UINT_MAX) {
+                err = "access-log-sample must be at least 1"; goto loaderr;
+            }
+            server.access_log_sample = sample;
+        } else if (!strcasecmp(argv[0],"access-log-buffer") && argc == 2) {
+            server.access_log_buffer = memtoll(argv[1], NULL);
+            if (server.access_log_buffer < 16*1024) {
+                err = "access-log-buffer must be at least 16kb"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"compile-threads") && argc == 2) {
+            server.compile_threads = atoi(argv[1]);
+            if (server.compile_threads < 1 || server.compile_threads > 64) {
+                err = "compile-threads must be between 1 and 64"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"http-workers") && argc == 2) {
+            server.http_workers = atoi(argv[1]);
+            if (server.http_workers < 0 || server.http_workers > HTTP_MAX_WORKERS) {
+                err = "http-workers must be between 0 and 256"; goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"hash-max-ziplist-entries") && argc == 2) {
             server.hash_max_ziplist_entries = memtoll(argv[1], NULL);
         } else if (!strcasecmp(argv[0],"hash-max-ziplist-value") && argc == 2) {
@@ -768,10 +859,10 @@ void configSetCommand(client *c) {
                 return;
             }
             if ((unsigned int) aeGetSetSize(server.el) <
-                server.maxclients + CONFIG_FDSET_INCR)
+                server.maxclients + CONFIG_FDSET_INCR + getHttpReservedFds())
             {
                 if (aeResizeSetSize(server.el,
-                    server.maxclients + CONFIG_FDSET_INCR) == AE_ERR)
+                    server.maxclients + CONFIG_FDSET_INCR + getHttpReservedFds()) == AE_ERR)
                 {
                     addReplyError(c,"The event loop API used by Redis is not able to handle the specified number of clients");
                     server.maxclients = orig_value;
@@ -1084,8 +1175,33 @@ void configGetCommand(client *c) {
     config_get_string_field("content-dir", server.content_dir);
     config_get_string_field("public-dir", server.public_dir);
     config_get_string_field("reload-content-query", server.reload_content_query);
+    config_get_string_field("cache-control-pages", server.cache_control_pages);
+    config_get_string_field("cache-control-posts", server.cache_control_posts);
+    config_get_string_field("cache-control-static", server.cache_control_static);
+    config_get_string_field("metrics-path", server.metrics_path);
+    config_get_string_field("access-log", server.access_log);
     config_get_numerical_field("per-page", server.per_page);
     config_get_numerical_field("markdown-compile", server.markdown_compile);
+    config_get_numerical_field("static-fd-cache", server.static_fd_cache);
+    config_get_numerical_field("static-memory-cache", server.static_memory_cache);
+    config_get_numerical_field("response-cache-entries", server.response_cache_entries);
+    config_get_numerical_field("http-max-header-size", server.http_max_header_size);
+    config_get_numerical_field("access-log-sample", server.access_log_sample);
+    config_get_numerical_field("access-log-buffer", server.access_log_buffer);
+    config_get_numerical_field("compile-threads", server.compile_threads);
+    config_get_numerical_field("http-workers", server.http_workers);
+    config_get_bool_field("content-watch", server.content_watch);
+    config_get_numerical_field("content-watch-delay", server.content_watch_delay);
+    config_get_enum_field("access-log-format", server.access_log_format, access_log_format_enum);
+    if (stringmatch(pattern,"markdown-extensions",1)) {
+        robj *flagsobj = createObject(OBJ_STRING,
+            markdownExtensionsToString(server.markdown_extensions));
+
+        addReplyBulkCString(c,"markdown-extensions");
+        addReplyBulk(c,flagsobj);
+        decrRefCount(flagsobj);
+        matches++;
+    }
 
     /* Numerical values */
     config_get_numerical_field("maxmemory",server.maxmemory);
@@ -1610,6 +1726,21 @@ void rewriteConfigNotifykeyspaceeventsOption(struct rewriteConfigState *state) {
     rewriteConfigRewriteLine(state,option,line,force);
 }
 
+/* Extend */
+/* Rewrite the markdown-extensions option. */
+void rewriteConfigMarkdownExtensionsOption(struct rewriteConfigState *state) {
+    int force = server.markdown_extensions != 0;
+    char *option = "markdown-extensions";
+    sds line, flags;
+
+    flags = markdownExtensionsToString(server.markdown_extensions);
+    line = sdsnew(option);
+    line = sdscatlen(line, " ", 1);
+    line = sdscatrepr(line, flags, sdslen(flags));
+    sdsfree(flags);
+    rewriteConfigRewriteLine(state,option,line,force);
+}
+
 /* Rewrite the client-output-buffer-limit option. */
 void rewriteConfigClientoutputbufferlimitOption(struct rewriteConfigState *state) {
     int j;
@@ -1826,6 +1957,23 @@ int rewriteConfig(char *path) {
     rewriteConfigStringOption(state,"reload-content-query",server.reload_content_query,CONFIG_DEFAULT_RELOAD_CONTENT_QUERY);
     rewriteConfigBytesOption(state,"per-page",server.per_page,CONFIG_DEFAULT_PER_PAGE);
     rewriteConfigBytesOption(state,"markdown-compile",server.markdown_compile,CONFIG_DEFAULT_MARDOWN_COMPILE);
+    rewriteConfigNumericalOption(state,"static-fd-cache",server.static_fd_cache,CONFIG_DEFAULT_STATIC_FD_CACHE);
+    rewriteConfigBytesOption(state,"static-memory-cache",server.static_memory_cache,CONFIG_DEFAULT_STATIC_MEMORY_CACHE);
+    rewriteConfigNumericalOption(state,"response-cache-entries",server.response_cache_entries,CONFIG_DEFAULT_RESPONSE_CACHE_ENTRIES);
+    rewriteConfigBytesOption(state,"http-max-header-size",server.http_max_header_size,CONFIG_DEFAULT_HTTP_MAX_HEADER_SIZE);
+    rewriteConfigNumericalOption(state,"compile-threads",server.compile_threads,CONFIG_DEFAULT_COMPILE_THREADS);
+    rewriteConfigNumericalOption(state,"http-workers",server.http_workers,CONFIG_DEFAULT_HTTP_WORKERS);
+    rewriteConfigYesNoOption(state,"content-watch",server.content_watch,CONFIG_DEFAULT_CONTENT_WATCH);
+    rewriteConfigNumericalOption(state,"content-watch-delay",server.content_watch_delay,CONFIG_DEFAULT_CONTENT_WATCH_DELAY);
+    rewriteConfigStringOption(state,"cache-control-pages",server.cache_control_pages,CONFIG_DEFAULT_CACHE_CONTROL_PAGES);
+    rewriteConfigStringOption(state,"cache-control-posts",server.cache_control_posts,CONFIG_DEFAULT_CACHE_CONTROL_POSTS);
+    rewriteConfigStringOption(state,"cache-control-static",server.cache_control_static,CONFIG_DEFAULT_CACHE_CONTROL_STATIC);
+    rewriteConfigStringOption(state,"metrics-path",server.metrics_path,CONFIG_DEFAULT_METRICS_PATH);
+    rewriteConfigStringOption(state,"access-log",server.access_log,CONFIG_DEFAULT_ACCESS_LOG);
+    rewriteConfigEnumOption(state,"access-log-format",server.access_log_format,access_log_format_enum,CONFIG_DEFAULT_ACCESS_LOG_FORMAT);
+    rewriteConfigNumericalOption(state,"access-log-sample",server.access_log_sample,CONFIG_DEFAULT_ACCESS_LOG_SAMPLE);
+    rewriteConfigBytesOption(state,"access-log-buffer",server.access_log_buffer,CONFIG_DEFAULT_ACCESS_LOG_BUFFER);
+    rewriteConfigMarkdownExtensionsOption(state);
 
     rewriteConfigDirOption(state);
     rewriteConfigSlaveofOption(state);
@@ -304,10 +304,12 @@ int selectDb(client *c, int id) {
 
 void signalModifiedKey(redisDb *db, robj *key) {
     touchWatchedKey(db,key);
+    touchHttpResponseCache(key); /* Extend */
 }
 
 void signalFlushedDb(int dbid) {
     touchWatchedKeysOnFlush(dbid);
+    touchHttpResponseCache(NULL); /* Extend */
 }
 
 /*-----------------------------------------------------------------------------
@@ -75,9 +75,8 @@ client *createClient(int fd) {
         if (server.tcpkeepalive)
             anetKeepAlive(NULL,fd,server.tcpkeepalive);
 
-        /* Extend */
         if (aeCreateFileEvent(server.el,fd,AE_READABLE,
-                              processHttpRequestFromClient, c) == AE_ERR)
+            readQueryFromClient, c) == AE_ERR)
         {
             close(fd);
             zfree(c);
@@ -130,8 +129,6 @@ client *createClient(int fd) {
     listSetMatchMethod(c->pubsub_patterns,listMatchObjects);
 
     /* Extend */
-    c->http_querybuf = sdsempty();
-    c->headers = NULL;
     c->command_last_error = NULL;
     c->command_last_reply = NULL;
 
@@ -624,73 +621,9 @@ int clientHasPendingReplies(client *c) {
 
 #define MAX_ACCEPTS_PER_CALL 1000
 static void acceptCommonHandler(int fd, int flags, char *ip) {
-    client *c;
-    if ((c = createClient(fd)) == NULL) {
-        serverLog(LL_WARNING,
-                  "Error registering fd event for the new client: %s (fd=%d)",
-                  strerror(errno),fd);
-        close(fd); /* May be already closed, just ignore errors */
-        return;
-    }
-    /* If maxclient directive is set and this is one client more... close the
-     * connection. Note that we create the client instead to check before
-     * for this condition, since now the socket is already set in non-blocking
-     * mode and we can send an error for free using the Kernel I/O */
-    if (listLength(server.clients) > server.maxclients) {
-        char *err = "-ERR max number of clients reached\r\n";
-
-        /* That's a best effort error message, don't check write errors */
-        if (write(c->fd,err,strlen(err)) == -1) {
-            /* Nothing to do, Just to avoid the warning... */
-        }
-        server.stat_rejected_conn++;
-        freeClient(c);
-        return;
-    }
-
-    /* If the server is running in protected mode (the default) and there
-     * is no password set, nor a specific interface is bound, we don't accept
-     * requests from non loopback interfaces. Instead we try to explain the
-     * user what to do to fix it if needed. */
-    if (server.protected_mode &&
-        server.bindaddr_count == 0 &&
-        server.requirepass == NULL &&
-        !(flags & CLIENT_UNIX_SOCKET) &&
-        ip != NULL)
-    {
-        if (strcmp(ip,"127.0.0.1") && strcmp(ip,"::1")) {
-            char *err =
-                    "-DENIED Redis is running in protected mode because protected "
-                            "mode is enabled, no bind address was specified, no "
-                            "authentication password is requested to clients. In this mode "
-                            "connections are only accepted from the loopback interface. "
-                            "If you want to connect from external computers to Redis you "
-                            "may adopt one of the following solutions: "
-                            "1) Just disable protected mode sending the command "
-                            "'CONFIG SET protected-mode no' from the loopback interface "
-                            "by connecting to Redis from the same host the server is "
-                            "running, however MAKE SURE Redis is not publicly accessible "
-                            "from internet if you do so. Use CONFIG REWRITE to make this "
-                            "change permanent. "
-                            "2) Alternatively you can just disable the protected mode by "
-                            "editing the Redis configuration file, and setting the protected "
-                            "mode option to 'no', and then restarting the server. "
-                            "3) If you started the server manually just for testing, restart "
-                            "it with the '--protected-mode no' option. "
-                            "4) Setup a bind address or an authentication password. "
-                            "NOTE: You only need to do one of the above things in order for "
-                            "the server to start accepting connections from the outside.\r\n";
-            if (write(c->fd,err,strlen(err)) == -1) {
-                /* Nothing to do, Just to avoid the warning... */
-            }
-            server.stat_rejected_conn++;
-            freeClient(c);
-            return;
-        }
-    }
-
-    server.stat_numconnections++;
-    c->flags |= flags;
+    /* Extend: every connection speaks HTTP, it is served by the main
+     * http loop. The limits are checked there, see createHttpConn(). */
+    acceptHttpConn(fd,flags,ip);
 }
 
 void acceptTcpHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
@@ -824,12 +757,6 @@ void freeClient(client *c) {
     c->querybuf = NULL;
 
     /* Extend */
-    sdsfree(c->http_querybuf);
-    c->http_querybuf = NULL;
-
-    sdsfree(c->headers);
-    c->headers = NULL;
-
     c->command_last_error = NULL;
     c->command_last_reply = NULL;
 
@@ -649,6 +649,67 @@ dictType migrateCacheDictType = {
     NULL                        /* val destructor */
 };
 
+/* Extend: open static files, see lookupStaticFile(). */
+void dictStaticFileDestructor(void *privdata, void *val)
+{
+    DICT_NOTUSED(privdata);
+
+    releaseStaticFile(val);
+}
+
+dictType staticFileDictType = {
+    dictSdsHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    dictSdsDestructor,          /* key destructor */
+    dictStaticFileDestructor    /* val destructor */
+};
+
+/* Extend: compiled posts, see compileContents(). */
+void dictContentPostDestructor(void *privdata, void *val)
+{
+    DICT_NOTUSED(privdata);
+
+    freeContentPost(val);
+}
+
+dictType contentPostDictType = {
+    dictSdsHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    dictSdsDestructor,          /* key destructor */
+    dictContentPostDestructor   /* val destructor */
+};
+
+/* Extend: compressed public files, see compileStaticDir(). */
+dictType contentFileDictType = {
+    dictSdsHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    dictSdsDestructor,          /* key destructor */
+    dictVanillaFree             /* val destructor */
+};
+
+/* Extend: routed request paths, see lookupHttpResponseCache(). */
+void dictHttpCachedResponseDestructor(void *privdata, void *val)
+{
+    DICT_NOTUSED(privdata);
+
+    freeHttpCachedResponse(val);
+}
+
+dictType httpResponseCacheDictType = {
+    dictSdsHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    dictSdsDestructor,          /* key destructor */
+    dictHttpCachedResponseDestructor /* val destructor */
+};
+
 /* Replication cached script dict (server.repl_scriptcache_dict).
  * Keys are sds SHA1 strings, while values are not used at all in the current
  * implementation. */
@@ -1170,6 +1231,14 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
     /* Handle background operations on Redis databases. */
     databasesCron();
 
+    /* Extend: start a reload after a change, swap in contents compiled by
+     * a bio thread. */
+    contentsCron();
+
+    /* Extend: hand the access log lines to a bio thread, close idle http
+     * connections, free the snapshots the http workers are done with. */
+    httpCron();
+
     /* Start a scheduled AOF rewrite if this was requested by the user while
      * a BGSAVE was in progress. */
     if (server.rdb_child_pid == -1 && server.aof_child_pid == -1 &&
@@ -1537,6 +1606,25 @@ void initServerConfig(void) {
     /* Extend */
     server.content_dir = zstrdup(CONFIG_DEFAULT_CONTENT_DIR);
     server.public_dir = zstrdup(CONFIG_DEFAULT_PUBLIC_DIR);
+    server.per_page = CONFIG_DEFAULT_PER_PAGE;
+    server.markdown_compile = CONFIG_DEFAULT_MARDOWN_COMPILE;
+    server.static_fd_cache = CONFIG_DEFAULT_STATIC_FD_CACHE;
+    server.static_memory_cache = CONFIG_DEFAULT_STATIC_MEMORY_CACHE;
+    server.response_cache_entries = CONFIG_DEFAULT_RESPONSE_CACHE_ENTRIES;
+    server.content_watch = CONFIG_DEFAULT_CONTENT_WATCH;
+    server.content_watch_delay = CONFIG_DEFAULT_CONTENT_WATCH_DELAY;
+    server.http_max_header_size = CONFIG_DEFAULT_HTTP_MAX_HEADER_SIZE;
+    server.compile_threads = CONFIG_DEFAULT_COMPILE_THREADS;
+    server.http_workers = CONFIG_DEFAULT_HTTP_WORKERS;
+    server.cache_control_pages = zstrdup(CONFIG_DEFAULT_CACHE_CONTROL_PAGES);
+    server.cache_control_posts = zstrdup(CONFIG_DEFAULT_CACHE_CONTROL_POSTS);
+    server.cache_control_static = zstrdup(CONFIG_DEFAULT_CACHE_CONTROL_STATIC);
+    server.metrics_path = zstrdup(CONFIG_DEFAULT_METRICS_PATH);
+    server.access_log = zstrdup(CONFIG_DEFAULT_ACCESS_LOG);
+    server.access_log_format = CONFIG_DEFAULT_ACCESS_LOG_FORMAT;
+    server.access_log_sample = CONFIG_DEFAULT_ACCESS_LOG_SAMPLE;
+    server.access_log_buffer = CONFIG_DEFAULT_ACCESS_LOG_BUFFER;
+    server.markdown_extensions = 0;
 
     server.lruclock = getLRUClock();
     resetServerSaveParams();
@@ -1664,17 +1752,20 @@ int restartServer(int flags, mstime_t delay) {
  * descriptors (CONFIG_MIN_RESERVED_FDS) for extra operations of
  * persistence, listening sockets, log files and so forth.
  *
+ * Extend: plus the ones of the http loops, see getHttpReservedFds().
+ *
  * If it will not be possible to set the limit accordingly to the configured
  * max number of clients, the function will do the reverse setting
  * server.maxclients to the value that we can actually handle. */
 void adjustOpenFilesLimit(void) {
-    rlim_t maxfiles = server.maxclients+CONFIG_MIN_RESERVED_FDS;
+    int reserved = CONFIG_MIN_RESERVED_FDS+getHttpReservedFds();
+    rlim_t maxfiles = server.maxclients+reserved;
     struct rlimit limit;
 
     if (getrlimit(RLIMIT_NOFILE,&limit) == -1) {
         serverLog(LL_WARNING,"Unable to obtain the current NOFILE limit (%s), assuming 1024 and setting the max clients configuration accordingly.",
             strerror(errno));
-        server.maxclients = 1024-CONFIG_MIN_RESERVED_FDS;
+        server.maxclients = 1024-reserved;
     } else {
         rlim_t oldlimit = limit.rlim_cur;
 
@@ -1707,7 +1798,7 @@ void adjustOpenFilesLimit(void) {
 
             if (bestlimit < maxfiles) {
                 int old_maxclients = server.maxclients;
-                server.maxclients = bestlimit-CONFIG_MIN_RESERVED_FDS;
+                server.maxclients = bestlimit-reserved;
                 if (server.maxclients < 1) {
                     serverLog(LL_WARNING,"Your current 'ulimit -n' "
                         "of %llu is not enough for the server to start. "
@@ -1776,6 +1867,11 @@ void checkTcpBacklogSettings(void) {
  * one of the IPv4 or IPv6 protocols. */
 int listenToPort(int port, int *fds, int *count) {
     int j;
+    /* Extend: the sockets of the http workers share the port. */
+    int (*tcpServer)(char*,int,char*,int) =
+        server.http_workers ? anetTcpReusePortServer : anetTcpServer;
+    int (*tcp6Server)(char*,int,char*,int) =
+        server.http_workers ? anetTcp6ReusePortServer : anetTcp6Server;
 
     /* Force binding of 0.0.0.0 if no bind address is specified, always
      * entering the loop if j == 0. */
@@ -1785,7 +1881,7 @@ int listenToPort(int port, int *fds, int *count) {
             int unsupported = 0;
             /* Bind * for both IPv6 and IPv4, we enter here only if
              * server.bindaddr_count == 0. */
-            fds[*count] = anetTcp6Server(server.neterr,port,NULL,
+            fds[*count] = tcp6Server(server.neterr,port,NULL,
                 server.tcp_backlog);
             if (fds[*count] != ANET_ERR) {
                 anetNonBlock(NULL,fds[*count]);
@@ -1797,7 +1893,7 @@ int listenToPort(int port, int *fds, int *count) {
 
             if (*count == 1 || unsupported) {
                 /* Bind the IPv4 address as well. */
-                fds[*count] = anetTcpServer(server.neterr,port,NULL,
+                fds[*count] = tcpServer(server.neterr,port,NULL,
                     server.tcp_backlog);
                 if (fds[*count] != ANET_ERR) {
                     anetNonBlock(NULL,fds[*count]);
@@ -1813,11 +1909,11 @@ int listenToPort(int port, int *fds, int *count) {
             if (*count + unsupported == 2) break;
         } else if (strchr(server.bindaddr[j],':')) {
             /* Bind IPv6 address. */
-            fds[*count] = anetTcp6Server(server.neterr,port,server.bindaddr[j],
+            fds[*count] = tcp6Server(server.neterr,port,server.bindaddr[j],
                 server.tcp_backlog);
         } else {
             /* Bind IPv4 address. */
-            fds[*count] = anetTcpServer(server.neterr,port,server.bindaddr[j],
+            fds[*count] = tcpServer(server.neterr,port,server.bindaddr[j],
                 server.tcp_backlog);
         }
         if (fds[*count] == ANET_ERR) {
@@ -1861,6 +1957,9 @@ void resetServerStats(void) {
     server.stat_net_input_bytes = 0;
     server.stat_net_output_bytes = 0;
     server.aof_delayed_fsync = 0;
+
+    /* Extend */
+    resetHttpStats();
 }
 
 void initServer(void) {
@@ -1892,11 +1991,12 @@ void initServer(void) {
 
     createSharedObjects();
     adjustOpenFilesLimit();
-    server.el = aeCreateEventLoop(server.maxclients+CONFIG_FDSET_INCR);
+    server.el = aeCreateEventLoop(server.maxclients+CONFIG_FDSET_INCR+getHttpReservedFds());
     server.db = zmalloc(sizeof(redisDb)*server.dbnum);
 
-    /* Open the TCP listening socket for the user commands. */
-    if (server.port != 0 &&
+    /* Open the TCP listening socket for the user commands.
+     * Extend: the http workers open their own, see initHttpLoops(). */
+    if (server.port != 0 && !server.http_workers &&
         listenToPort(server.port,server.ipfd,&server.ipfd_count) == C_ERR)
         exit(1);
 
@@ -1913,11 +2013,16 @@ void initServer(void) {
     }
 
     /* Abort if there are no listening sockets at all. */
-    if (server.ipfd_count == 0 && server.sofd < 0) {
+    if (server.ipfd_count == 0 && server.sofd < 0 &&
+        !(server.http_workers && server.port != 0))
+    {
         serverLog(LL_WARNING, "Configured to not listen anywhere, exiting.");
         exit(1);
     }
 
+    /* Extend */
+    server.contents = createContentIndex();
+
     /* Create the Redis databases, and initialize other internal state. */
     for (j = 0; j < server.dbnum; j++) {
         server.db[j].dict = dictCreate(&dbDictType,NULL);
@@ -2621,6 +2726,11 @@ int prepareForShutdown(int flags) {
 
     /* Close the listening sockets. Apparently this allows faster restarts. */
     closeListeningSockets(1);
+
+    /* Extend: stop the http workers, then write the access log lines
+     * still buffered. */
+    stopHttpWorkers();
+    closeAccessLog();
     serverLog(LL_WARNING,"%s is now ready to exit, bye bye...",
         server.sentinel_mode ? "Sentinel" : "Redis");
     return C_OK;
@@ -3310,6 +3420,12 @@ sds genRedisInfoString(char *section) {
             }
         }
     }
+
+    /* Extend: requests answered, by route and by status code */
+    if (allsections || defsections || !strcasecmp(section,"http")) {
+        if (sections++) info = sdscat(info,"\r\n");
+        info = genHttpInfoString(info);
+    }
     return info;
 }
 
@@ -4007,6 +4123,12 @@ int main(int argc, char **argv) {
     if (strstr(argv[0],"redis-check-rdb") != NULL)
         redis_check_rdb_main(argc,argv);
 
+#ifdef BLOGD_TEST
+    /* Extend: built by make test-blogd, see blogdTest(). */
+    if (argc == 5 && !strcasecmp(argv[1],"test") && !strcasecmp(argv[2],"blogd"))
+        return blogdTest(argc,argv);
+#endif
+
     if (argc >= 2) {
         j = 1; /* First option to parse in argv[] */
         sds options = sdsempty();
@@ -4080,6 +4202,10 @@ int main(int argc, char **argv) {
     if (background) daemonize();
 
     initServer();
+    /* Extend: routes first, requests are served while the dataset loads. */
+    initHttpRoutes();
+    initAccessLog();
+    initHttpLoops();
     if (background || server.pidfile) createPidFile();
     redisSetProcTitle(argv[0]);
     redisAsciiArt();
@@ -4092,6 +4218,8 @@ int main(int argc, char **argv) {
         linuxMemoryWarnings();
     #endif
         loadDataFromDisk();
+        /* Extend: let the http workers serve the loaded responses. */
+        publishHttpSnapshot();
         if (server.cluster_enabled) {
             if (verifyClusterConfigWithData() == C_ERR) {
                 serverLog(LL_WARNING,
@@ -4100,7 +4228,7 @@ int main(int argc, char **argv) {
                 exit(1);
             }
         }
-        if (server.ipfd_count > 0)
+        if (server.ipfd_count > 0 || (server.http_workers && server.port != 0))
             serverLog(LL_NOTICE,"The server is now ready to accept connections on port %d", server.port);
         if (server.sofd > 0)
             serverLog(LL_NOTICE,"The server is now ready to accept connections at %s", server.unixsocket);
@@ -4115,6 +4243,7 @@ int main(int argc, char **argv) {
 
     /* Extend */
     initContents(server.content_dir);
+    initContentsWatch();
 
     aeSetBeforeSleepProc(server.el,beforeSleep);
     aeMain(server.el);
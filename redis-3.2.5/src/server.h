@@ -87,6 +87,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_MAX_LINE    1024
 #define CRON_DBS_PER_CALL 16
 #define NET_MAX_WRITES_PER_EVENT (1024*64)
+#define NET_MAX_IOVCNT 64 /* Extend: max reply chunks per writev(2) call. */
 #define PROTO_SHARED_SELECT_CMDS 10
 #define OBJ_SHARED_INTEGERS 10000
 #define OBJ_SHARED_BULKHDR_LEN 32
@@ -148,6 +149,22 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_RELOAD_CONTENT_QUERY "secret-reload"
 #define CONFIG_DEFAULT_PER_PAGE 10
 #define CONFIG_DEFAULT_MARDOWN_COMPILE 0
+#define CONFIG_DEFAULT_STATIC_FD_CACHE 128
+#define CONFIG_DEFAULT_STATIC_MEMORY_CACHE 0
+#define CONFIG_DEFAULT_RESPONSE_CACHE_ENTRIES 10000
+#define CONFIG_DEFAULT_CONTENT_WATCH 1
+#define CONFIG_DEFAULT_CONTENT_WATCH_DELAY 500
+#define CONFIG_DEFAULT_HTTP_MAX_HEADER_SIZE 8192
+#define CONFIG_DEFAULT_METRICS_PATH ""
+#define CONFIG_DEFAULT_ACCESS_LOG ""
+#define CONFIG_DEFAULT_ACCESS_LOG_FORMAT HTTP_ACCESS_LOG_COMBINED
+#define CONFIG_DEFAULT_ACCESS_LOG_SAMPLE 1
+#define CONFIG_DEFAULT_ACCESS_LOG_BUFFER (1024*1024)
+#define CONFIG_DEFAULT_COMPILE_THREADS 4
+#define CONFIG_DEFAULT_HTTP_WORKERS 0
+#define CONFIG_DEFAULT_CACHE_CONTROL_PAGES "no-cache"
+#define CONFIG_DEFAULT_CACHE_CONTROL_POSTS "no-cache"
+#define CONFIG_DEFAULT_CACHE_CONTROL_STATIC "public, max-age=3600"
 
 #define ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP 20 /* Loopkups per loop. */
 #define ACTIVE_EXPIRE_CYCLE_FAST_DURATION 1000 /* Microseconds */
@@ -624,8 +641,6 @@ typedef struct client {
     char buf[PROTO_REPLY_CHUNK_BYTES];
 
     /* Extend */
-    char *headers;
-    sds http_querybuf;
     char *command_last_error;
     char *command_last_reply;
 } client;
@@ -999,6 +1014,24 @@ struct redisServer {
     char *reload_content_query;
     unsigned int per_page;
     unsigned int markdown_compile;
+    unsigned int markdown_extensions; /* Sundown MKDEXT_* flags */
+    unsigned int static_fd_cache; /* Max open static files kept cached */
+    size_t static_memory_cache;   /* Byte budget of the whole responses kept, 0 to disable */
+    unsigned int response_cache_entries; /* Request paths remembered with their response, 0 to disable */
+    size_t http_max_header_size;  /* Larger request headers get a 431 */
+    contentIndex *contents;       /* What compileContents() compiled last time */
+    int compile_threads;          /* Threads compiling the posts */
+    char *cache_control_pages;    /* Cache-Control of the index and pagination pages */
+    char *cache_control_posts;
+    char *cache_control_static;   /* Cache-Control of the public files */
+    int content_watch;            /* Reload when content or public dir changes */
+    long long content_watch_delay; /* Milliseconds without changes before reloading */
+    char *metrics_path;           /* Path of the Prometheus metrics, "" to disable */
+    char *access_log;             /* Path of the access log, "" to disable */
+    int access_log_format;        /* HTTP_ACCESS_LOG_* */
+    unsigned int access_log_sample; /* Log one request in access_log_sample */
+    size_t access_log_buffer;     /* Size of each of the two line buffers */
+    int http_workers;             /* Threads serving HTTP, 0 to serve on the main thread */
 };
 
 typedef struct pubsubPattern {
@@ -1096,6 +1129,10 @@ extern dictType shaScriptObjectDictType;
 extern double R_Zero, R_PosInf, R_NegInf, R_Nan;
 extern dictType hashDictType;
 extern dictType replScriptCacheDictType;
+extern dictType staticFileDictType;
+extern dictType contentPostDictType;
+extern dictType contentFileDictType;
+extern dictType httpResponseCacheDictType;
 
 /*-----------------------------------------------------------------------------
  * Functions prototypes